@@ -0,0 +1,221 @@
+//
+// \file psi_analytics_eurocrypt19_bench.cpp
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+
+// Microbenchmarks of the kernels of the protocol. The time of an iteration is the time of one
+// operation (ns/op); the cases over many elements also report elements/s.
+
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "common/constants.h"
+#include "common/helpers.h"
+#include "common/parallel_hashing.h"
+#include "common/psi_analytics_context.h"
+#include "ots/ots.h"
+#include "polynomials/Poly.h"
+
+#include "HashingTables/cuckoo_hashing/cuckoo_hashing.h"
+#include "HashingTables/simple_hashing/simple_hashing.h"
+
+namespace {
+
+constexpr uint16_t BENCHMARK_PORT = 7777;
+
+std::vector<ZpMersenneLongElement> RandomFieldElements(std::size_t n, std::mt19937_64 &engine) {
+  std::vector<ZpMersenneLongElement> elements(n);
+  for (auto &element : elements) {
+    // the inverse of 0 is not defined
+    element.elem = std::max<uint64_t>(engine() & ENCRYPTO::__61_bit_mask, 1) %
+                   ZpMersenneLongElement::p;
+  }
+  return elements;
+}
+
+void BM_FieldMul(benchmark::State &state) {
+  std::mt19937_64 engine(0);
+  auto operands = RandomFieldElements(1024, engine);
+  auto product = operands.front();
+  std::size_t i = 0;
+  for (auto _ : state) {
+    product = product * operands[i++ % operands.size()];
+    benchmark::DoNotOptimize(product.elem);
+  }
+}
+BENCHMARK(BM_FieldMul);
+
+void BM_FieldInverse(benchmark::State &state) {
+  std::mt19937_64 engine(0);
+  auto operands = RandomFieldElements(1024, engine);
+  ZpMersenneLongElement one(1), inverse;
+  std::size_t i = 0;
+  for (auto _ : state) {
+    inverse = one / operands[i++ % operands.size()];
+    benchmark::DoNotOptimize(inverse.elem);
+  }
+}
+BENCHMARK(BM_FieldInverse);
+
+// the polynomial sizes of the tests, i.e., for 2^12, 2^16 and 2^20 elements
+void PolynomialSizes(benchmark::internal::Benchmark *benchmark) {
+  benchmark->Arg(975)->Arg(1021)->Arg(1024)->Unit(benchmark::kMicrosecond);
+}
+
+void BM_Interpolation(benchmark::State &state) {
+  const auto k = static_cast<std::size_t>(state.range(0));
+  std::mt19937_64 engine(0);
+  const auto X = RandomFieldElements(k, engine);
+  auto Y = RandomFieldElements(k, engine);
+  std::vector<ZpMersenneLongElement> coefficients(k);
+  for (auto _ : state) {
+    Poly::interpolateMersenne(coefficients, X, Y);
+    benchmark::DoNotOptimize(coefficients.data());
+  }
+  state.SetItemsProcessed(state.iterations() * k);
+}
+BENCHMARK(BM_Interpolation)->Apply(PolynomialSizes);
+
+void BM_Evaluation(benchmark::State &state) {
+  const auto k = static_cast<std::size_t>(state.range(0));
+  std::mt19937_64 engine(0);
+  const auto coefficients = RandomFieldElements(k, engine);
+  const auto X = RandomFieldElements(1024, engine);
+  ZpMersenneLongElement Y;
+  std::size_t i = 0;
+  for (auto _ : state) {
+    Poly::evalMersenne(Y, coefficients, X[i++ % X.size()]);
+    benchmark::DoNotOptimize(Y.elem);
+  }
+  state.SetItemsProcessed(state.iterations() * k);
+}
+BENCHMARK(BM_Evaluation)->Apply(PolynomialSizes);
+
+// 2^12 to 2^24 elements in steps of 4x
+void TableSizes(benchmark::internal::Benchmark *benchmark) {
+  benchmark->RangeMultiplier(4)->Range(1 << 12, 1 << 24)->Unit(benchmark::kMillisecond);
+}
+
+template <typename Table>
+void BM_TableInsertion(benchmark::State &state) {
+  const auto n = static_cast<std::size_t>(state.range(0));
+  const auto elements = ENCRYPTO::GeneratePseudoRandomElements(n, 61);
+  for (auto _ : state) {
+    Table table(static_cast<std::size_t>(n * 1.27));
+    table.SetNumOfHashFunctions(3);
+    table.Insert(elements);
+    table.MapElements();
+    benchmark::DoNotOptimize(&table);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(BM_TableInsertion, ENCRYPTO::CuckooTable)->Apply(TableSizes);
+BENCHMARK_TEMPLATE(BM_TableInsertion, ENCRYPTO::SimpleTable)->Apply(TableSizes);
+
+// the tables of the protocol, which are built from the batched addresses, for 2^12 to 2^24
+// elements with 1 to 8 threads; the wall time is measured, since the threads run in parallel
+void HashingSizes(benchmark::internal::Benchmark *benchmark) {
+  for (auto n = 1 << 12; n <= 1 << 24; n *= 4) {
+    for (auto nthreads = 1; nthreads <= 8; nthreads *= 2) {
+      benchmark->Args({n, nthreads});
+    }
+  }
+  benchmark->UseRealTime()->Unit(benchmark::kMillisecond);
+}
+
+template <bool cuckoo>
+void BM_Hashing(benchmark::State &state) {
+  const auto n = static_cast<std::size_t>(state.range(0));
+  const auto elements = ENCRYPTO::GeneratePseudoRandomElements(n, 61);
+  ENCRYPTO::PsiAnalyticsContext context{BENCHMARK_PORT, CLIENT};
+  context.nbins = static_cast<uint64_t>(n * 1.27);
+  context.nfuns = 3;
+  context.nthreads = static_cast<uint64_t>(state.range(1));
+  std::vector<uint64_t> stash;
+  for (auto _ : state) {
+    if (cuckoo) {
+      benchmark::DoNotOptimize(ENCRYPTO::ParallelCuckooHashing(elements, context, &stash));
+    } else {
+      benchmark::DoNotOptimize(ENCRYPTO::ParallelSimpleHashing(elements, context));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(BM_Hashing, true)->Apply(HashingSizes);
+BENCHMARK_TEMPLATE(BM_Hashing, false)->Apply(HashingSizes);
+
+// the three bin addresses of every element with the batched kernel and one at a time
+void BM_AddressKernel(benchmark::State &state) {
+  const auto n = static_cast<std::size_t>(state.range(0));
+  const auto elements = ENCRYPTO::GeneratePseudoRandomElements(n, 61);
+  std::vector<uint32_t> addresses(3 * n);
+  for (auto _ : state) {
+    ENCRYPTO::BinAddressesOf(elements.data(), n, 3, static_cast<std::size_t>(n * 1.27),
+                             addresses.data());
+    benchmark::DoNotOptimize(addresses.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_AddressKernel)->Apply(TableSizes);
+
+void BM_AddressScalar(benchmark::State &state) {
+  const auto n = static_cast<std::size_t>(state.range(0));
+  const auto elements = ENCRYPTO::GeneratePseudoRandomElements(n, 61);
+  const auto nbins = static_cast<std::size_t>(n * 1.27);
+  std::vector<uint32_t> addresses(3 * n);
+  for (auto _ : state) {
+    for (auto i = 0ull; i < n; ++i) {
+      for (auto j = 0ull; j < 3; ++j) {
+        addresses[3 * i + j] =
+            static_cast<uint32_t>(ENCRYPTO::BinAddressOf(elements[i], j, nbins));
+      }
+    }
+    benchmark::DoNotOptimize(addresses.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_AddressScalar)->Apply(TableSizes);
+
+// KKRT encoding of one element per bin by the receiver and three per bin by the sender over a
+// loopback channel; the time is the sender's OPRF time without the base OTs
+void BM_OprfEncoding(benchmark::State &state) {
+  const auto nbins = static_cast<std::size_t>(state.range(0));
+  std::mt19937_64 engine(0);
+  std::vector<uint64_t> receiver_bins(nbins);
+  ENCRYPTO::BinnedElements sender_bins;
+  for (auto &bin : receiver_bins) {
+    bin = engine() & ENCRYPTO::__61_bit_mask;
+    const uint64_t sender_bin[] = {bin, engine() & ENCRYPTO::__61_bit_mask,
+                                   engine() & ENCRYPTO::__61_bit_mask};
+    sender_bins.AppendBin(std::begin(sender_bin), std::end(sender_bin));
+  }
+
+  ENCRYPTO::PsiAnalyticsContext client_context{BENCHMARK_PORT, CLIENT};
+  client_context.address = "127.0.0.1";
+  client_context.nthreads = 1;
+  auto server_context = client_context;
+  server_context.role = SERVER;
+  for (auto _ : state) {
+    std::thread sender([&]() { ENCRYPTO::ot_sender(sender_bins, server_context); });
+    ENCRYPTO::ot_receiver(receiver_bins, client_context);
+    sender.join();
+    state.SetIterationTime(server_context.timings.oprf / 1e3);
+  }
+  state.SetItemsProcessed(state.iterations() * sender_bins.elements.size());
+}
+BENCHMARK(BM_OprfEncoding)
+    ->RangeMultiplier(4)
+    ->Range(1 << 12, 1 << 18)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
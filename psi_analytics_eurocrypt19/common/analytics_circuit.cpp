@@ -0,0 +1,487 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "analytics_circuit.h"
+#include "constants.h"
+
+#include "abycore/sharing/sharing.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <ratio>
+#include <stdexcept>
+
+namespace ENCRYPTO {
+
+using milliseconds_ratio = std::ratio<1, 1000>;
+using duration_millis = std::chrono::duration<double, milliseconds_ratio>;
+
+share_ptr PutSIMDSumGate(ArithmeticCircuit *ac, share_ptr s_values) {
+  share_ptr s_carry;
+  std::vector<uint32_t> positions;
+
+  // add the lower and the upper half of the SIMD values until one value is left, odd values
+  // are collected in s_carry
+  for (auto nvals = s_values->get_nvals(); nvals > 1; nvals /= 2) {
+    const auto half = nvals / 2;
+    positions.resize(half);
+    std::iota(positions.begin(), positions.end(), 0);
+    auto s_lower = share_ptr(ac->PutSubsetGate(s_values.get(), positions.data(), half));
+    std::iota(positions.begin(), positions.end(), half);
+    auto s_upper = share_ptr(ac->PutSubsetGate(s_values.get(), positions.data(), half));
+
+    if (nvals % 2 == 1) {
+      uint32_t last = nvals - 1;
+      auto s_last = share_ptr(ac->PutSubsetGate(s_values.get(), &last, 1));
+      s_carry = s_carry ? share_ptr(ac->PutADDGate(s_carry.get(), s_last.get())) : s_last;
+    }
+
+    s_values = share_ptr(ac->PutADDGate(s_lower.get(), s_upper.get()));
+  }
+
+  if (s_carry) {
+    s_values = share_ptr(ac->PutADDGate(s_values.get(), s_carry.get()));
+  }
+  return s_values;
+}
+
+share_ptr PutLowerBitsGate(Circuit *circ, share_ptr s_in, uint32_t bitlen) {
+  auto wires = s_in->get_wires();
+  wires.resize(std::min<std::size_t>(bitlen, wires.size()));
+  return share_ptr(new boolshare(wires, circ));
+}
+
+namespace {
+
+// compares the sum with every threshold of the context and outputs the result of THRESHOLD or
+// SUM_IF_GT_THRESHOLD for each of them; all comparisons share the same sum, so every further
+// threshold only costs one comparison (and a multiplexer)
+std::vector<share_ptr> PutThresholdOutGates(BooleanCircuit *tc, const share_ptr &s_sum,
+                                            const PsiAnalyticsContext &context) {
+  if (context.analytics_type != PsiAnalyticsContext::THRESHOLD &&
+      context.analytics_type != PsiAnalyticsContext::SUM_IF_GT_THRESHOLD) {
+    throw std::runtime_error("Encountered an unknown analytics type");
+  }
+
+  const auto thresholds =
+      context.thresholds.empty() ? std::vector<uint64_t>{context.threshold} : context.thresholds;
+  std::vector<share_ptr> s_outs;
+  for (auto threshold : thresholds) {
+    auto t_bitlen = static_cast<uint32_t>(std::ceil(std::log2(threshold + 1)));
+    auto s_threshold = share_ptr(tc->PutCONSGate(threshold, std::max(t_bitlen, 1u)));
+    auto s_gt_t = share_ptr(tc->PutGTGate(s_sum.get(), s_threshold.get()));
+
+    share_ptr s_out;
+    if (context.analytics_type == PsiAnalyticsContext::THRESHOLD) {
+      s_out = s_gt_t;
+    } else {
+      std::uint64_t const_zero = 0;
+      auto s_zero = share_ptr(tc->PutCONSGate(const_zero, 1));
+      s_out = share_ptr(tc->PutMUXGate(s_sum.get(), s_zero.get(), s_gt_t.get()));
+    }
+    s_outs.push_back(share_ptr(tc->PutOUTGate(s_out.get(), ALL)));
+  }
+  return s_outs;
+}
+
+// converts the arithmetic sum to the sharing of tc, which is Yao or GMW; ABY converts arithmetic
+// to GMW shares via Yao, hence the Yao circuit yc
+share_ptr PutSumToBooleanGate(BooleanCircuit *tc, BooleanCircuit *yc, const share_ptr &s_sum_arith,
+                              uint64_t max_sum) {
+  // the sum is at most max_sum, so only the lower bits need to be compared
+  const auto sum_bitlen = static_cast<uint32_t>(std::ceil(std::log2(max_sum + 1)));
+  auto s_sum = share_ptr(tc == yc ? yc->PutA2YGate(s_sum_arith.get())
+                                  : tc->PutA2BGate(s_sum_arith.get(), yc));
+  return PutLowerBitsGate(tc, s_sum, std::max(sum_bitlen, 1u));
+}
+
+// connects to address:port once and closes the connection right away; failures are ignored
+void ConnectAndClose(const std::string &address, uint16_t port) {
+  sockaddr_in socket_address;
+  std::memset(&socket_address, 0, sizeof(socket_address));
+  socket_address.sin_family = AF_INET;
+  socket_address.sin_port = htons(port);
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return;
+  }
+  if (inet_pton(AF_INET, address.c_str(), &socket_address.sin_addr) == 1) {
+    connect(fd, reinterpret_cast<sockaddr *>(&socket_address), sizeof(socket_address));
+  }
+  close(fd);
+}
+
+}  // namespace
+
+std::vector<share_ptr> BuildAnalyticsCircuit(ABYParty &party, std::vector<uint64_t> &bins,
+                                             const PsiAnalyticsContext &context,
+                                             std::vector<uint64_t> &payload_bins,
+                                             bool shared_aggregates) {
+  auto &sharings = party.GetSharings();
+  auto bc = dynamic_cast<BooleanCircuit *>(sharings.at(S_BOOL)->GetCircuitBuildRoutine());
+  auto yc = dynamic_cast<BooleanCircuit *>(sharings.at(S_YAO)->GetCircuitBuildRoutine());
+  auto ac = dynamic_cast<ArithmeticCircuit *>(sharings.at(S_ARITH)->GetCircuitBuildRoutine());
+  assert(bc && yc && ac);
+
+  const bool yao_comparison = context.circuit_type == PsiAnalyticsContext::YAO ||
+                              context.circuit_type == PsiAnalyticsContext::YAO_ARITHMETIC;
+  const bool arithmetic_sum = context.circuit_type == PsiAnalyticsContext::GMW_ARITHMETIC ||
+                              context.circuit_type == PsiAnalyticsContext::YAO_ARITHMETIC;
+
+  // Yao has a constant number of rounds, GMW needs one round per layer of AND gates
+  BooleanCircuit *cc = yao_comparison ? yc : bc;
+
+  const auto nbins = static_cast<uint32_t>(bins.size());
+  share_ptr s_in_server, s_in_client;
+
+  // share inputs in ABY
+  if (context.role == SERVER) {
+    s_in_server = share_ptr(cc->PutSIMDINGate(nbins, bins.data(), context.maxbitlen, SERVER));
+    s_in_client = share_ptr(cc->PutDummySIMDINGate(nbins, context.maxbitlen));
+  } else {
+    s_in_server = share_ptr(cc->PutDummySIMDINGate(nbins, context.maxbitlen));
+    s_in_client = share_ptr(cc->PutSIMDINGate(nbins, bins.data(), context.maxbitlen, CLIENT));
+  }
+
+  // compare outputs of OPPRFs for each bin in ABY (using SIMD)
+  auto s_eq = share_ptr(cc->PutEQGate(s_in_server.get(), s_in_client.get()));
+
+  if (context.analytics_type == PsiAnalyticsContext::NONE) {
+    // we want to only do benchmarking, so no additional operations
+    return {};
+  }
+
+  if (context.analytics_type == PsiAnalyticsContext::MATCH_SHARES) {
+    // Yao shares can not be output as such, so they are converted to XOR shares first
+    if (yao_comparison) {
+      s_eq = share_ptr(bc->PutY2BGate(s_eq.get()));
+    }
+    return {share_ptr(bc->PutSharedOUTGate(s_eq.get()))};
+  }
+
+  // converts a share of the comparison circuit to arithmetic sharing
+  const auto put_to_arith_gate = [&](const share_ptr &s_in) {
+    return share_ptr(yao_comparison ? ac->PutY2AGate(s_in.get(), bc)
+                                    : ac->PutB2AGate(s_in.get()));
+  };
+  // reveals an aggregate or, for a shard, outputs this party's arithmetic share of it
+  const auto put_aggregate_out_gate = [&](const share_ptr &s_aggregate) {
+    return share_ptr(shared_aggregates ? ac->PutSharedOUTGate(s_aggregate.get())
+                                       : ac->PutOUTGate(s_aggregate.get(), ALL));
+  };
+
+  if (context.analytics_type == PsiAnalyticsContext::PAYLOAD_SUM ||
+      context.analytics_type == PsiAnalyticsContext::GROUPED_SUM) {
+    if (payload_bins.size() != nbins) {
+      throw std::runtime_error("Expected exactly one payload share per bin");
+    }
+    const auto payload_bitlen = static_cast<uint32_t>(context.GetPayloadBitlen());
+    share_ptr s_payload_server, s_payload_client;
+    if (context.role == SERVER) {
+      s_payload_server =
+          share_ptr(cc->PutSIMDINGate(nbins, payload_bins.data(), payload_bitlen, SERVER));
+      s_payload_client = share_ptr(cc->PutDummySIMDINGate(nbins, payload_bitlen));
+    } else {
+      s_payload_server = share_ptr(cc->PutDummySIMDINGate(nbins, payload_bitlen));
+      s_payload_client =
+          share_ptr(cc->PutSIMDINGate(nbins, payload_bins.data(), payload_bitlen, CLIENT));
+    }
+
+    // the client holds payload ^ mask for the matched bins and random values otherwise, so the
+    // unmasked payloads are multiplied with the equality bits before summing them up
+    auto s_payload = share_ptr(cc->PutXORGate(s_payload_server.get(), s_payload_client.get()));
+
+    if (context.analytics_type == PsiAnalyticsContext::GROUPED_SUM) {
+      // every bit of the one-hot payload is one category: AND it with the equality bit, then count
+      // the matches of each category separately in arithmetic sharing
+      std::vector<uint32_t> eq_wires(payload_bitlen, s_eq->get_wire_id(0));
+      auto s_eq_repeated = share_ptr(new boolshare(eq_wires, cc));
+      auto s_matched = share_ptr(cc->PutANDGate(s_payload.get(), s_eq_repeated.get()));
+
+      std::vector<share_ptr> s_outs;
+      for (auto category = 0u; category < payload_bitlen; ++category) {
+        auto s_category = share_ptr(new boolshare({s_matched->get_wire_id(category)}, cc));
+        auto s_count = PutSIMDSumGate(ac, put_to_arith_gate(s_category));
+        s_outs.push_back(put_aggregate_out_gate(s_count));
+      }
+      return s_outs;
+    }
+    auto s_eq_arith = put_to_arith_gate(s_eq), s_payload_arith = put_to_arith_gate(s_payload);
+    auto s_matched_payload = share_ptr(ac->PutMULGate(s_eq_arith.get(), s_payload_arith.get()));
+    auto s_payload_sum = PutSIMDSumGate(ac, s_matched_payload);
+    return {put_aggregate_out_gate(s_payload_sum)};
+  }
+
+  // the number of matches is compared with the thresholds in the sharing of the equality checks
+  share_ptr s_sum, s_sum_out;
+
+  if (arithmetic_sum || shared_aggregates) {
+    // Count the matches in arithmetic sharing: each equality bit is converted with one OT, after
+    // which the additions are local. This replaces a Boolean Hamming weight circuit with
+    // O(nbins) AND gates and O(log(nbins)) depth.
+    auto s_sum_arith = PutSIMDSumGate(ac, put_to_arith_gate(s_eq));
+
+    if (shared_aggregates) {
+      // the thresholds are applied to the sum of all shards, see BuildShardCombinationCircuit
+      return {put_aggregate_out_gate(s_sum_arith)};
+    } else if (context.analytics_type == PsiAnalyticsContext::SUM) {
+      return {share_ptr(ac->PutOUTGate(s_sum_arith.get(), ALL))};
+    } else if (context.output_sum) {
+      s_sum_out = share_ptr(ac->PutOUTGate(s_sum_arith.get(), ALL));
+    }
+
+    // the comparison with the threshold needs Boolean sharing
+    s_sum = PutSumToBooleanGate(cc, yc, s_sum_arith, nbins);
+  } else {
+    auto s_eq_rotated = share_ptr(cc->PutSplitterGate(s_eq.get()));
+    s_sum = share_ptr(cc->PutHammingWeightGate(s_eq_rotated.get()));
+
+    if (context.analytics_type == PsiAnalyticsContext::SUM) {
+      return {share_ptr(cc->PutOUTGate(s_sum.get(), ALL))};
+    } else if (context.output_sum) {
+      s_sum_out = share_ptr(cc->PutOUTGate(s_sum.get(), ALL));
+    }
+  }
+
+  auto s_outs = PutThresholdOutGates(cc, s_sum, context);
+  if (s_sum_out) {
+    s_outs.push_back(s_sum_out);
+  }
+  return s_outs;
+}
+
+std::vector<share_ptr> BuildShardCombinationCircuit(ABYParty &party,
+                                                    const std::vector<uint64_t> &aggregate_shares,
+                                                    const PsiAnalyticsContext &context,
+                                                    uint64_t max_sum) {
+  auto &sharings = party.GetSharings();
+  auto bc = dynamic_cast<BooleanCircuit *>(sharings.at(S_BOOL)->GetCircuitBuildRoutine());
+  auto yc = dynamic_cast<BooleanCircuit *>(sharings.at(S_YAO)->GetCircuitBuildRoutine());
+  auto ac = dynamic_cast<ArithmeticCircuit *>(sharings.at(S_ARITH)->GetCircuitBuildRoutine());
+  assert(bc && yc && ac);
+
+  // the shares of the shards were added up locally, which adds up the shared aggregates
+  std::vector<share_ptr> s_aggregates;
+  for (auto aggregate_share : aggregate_shares) {
+    s_aggregates.push_back(share_ptr(ac->PutSharedINGate(aggregate_share, ac->GetShareBitLen())));
+  }
+
+  if (context.analytics_type == PsiAnalyticsContext::NONE) {
+    return {};
+  }
+
+  if (context.analytics_type == PsiAnalyticsContext::SUM ||
+      context.analytics_type == PsiAnalyticsContext::PAYLOAD_SUM ||
+      context.analytics_type == PsiAnalyticsContext::GROUPED_SUM) {
+    std::vector<share_ptr> s_outs;
+    for (const auto &s_aggregate : s_aggregates) {
+      s_outs.push_back(share_ptr(ac->PutOUTGate(s_aggregate.get(), ALL)));
+    }
+    return s_outs;
+  }
+
+  if (s_aggregates.size() != 1) {
+    throw std::runtime_error("Expected exactly one shared sum");
+  }
+  // the thresholds are compared in the sharing of the equality checks of the shards
+  const bool yao_comparison = context.circuit_type == PsiAnalyticsContext::YAO ||
+                              context.circuit_type == PsiAnalyticsContext::YAO_ARITHMETIC;
+  auto tc = yao_comparison ? yc : bc;
+  auto s_outs = PutThresholdOutGates(
+      tc, PutSumToBooleanGate(tc, yc, s_aggregates.front(), max_sum), context);
+  if (context.output_sum) {
+    s_outs.push_back(share_ptr(ac->PutOUTGate(s_aggregates.front().get(), ALL)));
+  }
+  return s_outs;
+}
+
+AnalyticsCircuitSession::AnalyticsCircuitSession(const PsiAnalyticsContext &context)
+    : party_(std::make_unique<ABYParty>(static_cast<e_role>(context.role), context.address,
+                                        context.port + aby_port_offset, LT, 64,
+                                        context.nthreads)),
+      role_(context.role),
+      address_(context.address),
+      port_(context.port),
+      nthreads_(context.nthreads) {}
+
+double AnalyticsCircuitSession::Prepare() {
+  std::lock_guard<std::mutex> lock(preparation_mutex_);
+  if (!party_) {
+    throw std::runtime_error("The circuit session was aborted");
+  }
+  if (prepared_) {
+    return 0;
+  }
+
+  const auto preparation_start_time = MetricsRegistry::Clock::now();
+
+  party_->ConnectAndBaseOTs();
+  base_ots_duration_ = party_->GetTiming(P_BASE_OT);
+  base_ots_communication_.sent_bytes = party_->GetSentData(P_BASE_OT);
+  base_ots_communication_.received_bytes = party_->GetReceivedData(P_BASE_OT);
+  prepared_ = true;
+
+  const auto preparation_end_time = MetricsRegistry::Clock::now();
+  const duration_millis preparation_duration = preparation_end_time - preparation_start_time;
+  return preparation_duration.count();
+}
+
+void AnalyticsCircuitSession::Abort() {
+  // ABY's handshake fails on a connection that is closed before the client identified itself,
+  // which ends a Prepare that is blocked in accept; nobody listens after the handshake
+  if (role_ == SERVER) {
+    ConnectAndClose(address_, port_ + aby_port_offset);
+  }
+  std::lock_guard<std::mutex> lock(preparation_mutex_);
+  party_.reset();
+}
+
+void AnalyticsCircuitSession::Run(
+    PsiAnalyticsContext &context, const std::function<std::vector<share_ptr>()> &build,
+    const std::function<void(const std::vector<share_ptr> &)> &read_outputs) {
+  if (context.role != role_ || context.address != address_ || context.port != port_ ||
+      context.nthreads != nthreads_) {
+    throw std::runtime_error("The circuit session was set up for another connection");
+  }
+
+  Prepare();
+  // the base OTs are reused after the first query
+  context.timings.base_ots_aby = nqueries_ == 0 ? base_ots_duration_ : 0;
+  context.communication.base_ots_aby =
+      nqueries_ == 0 ? base_ots_communication_ : PsiAnalyticsContext::Communication();
+  if (nqueries_ == 0) {
+    context.metrics.Add("analytics/preparation/base_ots", base_ots_duration_);
+  }
+
+  auto circuit_timer = context.metrics.Time("analytics/circuit_construction");
+
+  auto s_outs = build();
+
+  context.timings.circuit_construction = circuit_timer.Stop();
+
+  // the setup and online phases are timed by ABY, this also covers the memory of the execution
+  auto execution_timer = context.metrics.Time("analytics/execution");
+  const auto execution_start_time = MetricsRegistry::Clock::now();
+  party_->ExecCircuit();
+  const auto execution_end_time = MetricsRegistry::Clock::now();
+  execution_timer.Stop();
+
+  read_outputs(s_outs);
+
+  context.timings.aby_setup = party_->GetTiming(P_SETUP);
+  context.timings.aby_online = party_->GetTiming(P_ONLINE);
+  context.timings.aby_total = context.timings.aby_setup + context.timings.aby_online;
+  context.metrics.Add("analytics/setup", context.timings.aby_setup);
+  context.metrics.Add("analytics/online", context.timings.aby_online);
+  // ABY runs the setup before the online phase, so they are placed at the ends of the execution
+  if (auto trace = context.metrics.GetTrace()) {
+    const auto setup_duration = std::chrono::duration_cast<MetricsRegistry::Clock::duration>(
+        duration_millis(context.timings.aby_setup));
+    const auto online_duration = std::chrono::duration_cast<MetricsRegistry::Clock::duration>(
+        duration_millis(context.timings.aby_online));
+    trace->Complete("ABY setup", "analytics", execution_start_time,
+                    execution_start_time + setup_duration);
+    trace->Complete("ABY online", "analytics", execution_end_time - online_duration,
+                    execution_end_time);
+  }
+  context.communication.aby_setup.sent_bytes = party_->GetSentData(P_SETUP);
+  context.communication.aby_setup.received_bytes = party_->GetReceivedData(P_SETUP);
+  context.communication.aby_online.sent_bytes = party_->GetSentData(P_ONLINE);
+  context.communication.aby_online.received_bytes = party_->GetReceivedData(P_ONLINE);
+
+  // drop the gates but keep the connection and the base OTs for the next query
+  s_outs.clear();
+  party_->Reset();
+  ++nqueries_;
+}
+
+uint64_t AnalyticsCircuitSession::Execute(std::vector<uint64_t> &bins,
+                                          PsiAnalyticsContext &context,
+                                          std::vector<uint64_t> &payload_bins,
+                                          std::vector<uint8_t> *match_bits) {
+  context.outputs.clear();
+  Run(
+      context, [&]() { return BuildAnalyticsCircuit(*party_, bins, context, payload_bins); },
+      [&](const std::vector<share_ptr> &s_outs) {
+        if (!s_outs.empty() && context.analytics_type == PsiAnalyticsContext::MATCH_SHARES) {
+          if (!match_bits) {
+            throw std::runtime_error("No buffer for the match shares was given");
+          }
+          uint64_t *values;
+          uint32_t bitlen, nvals;
+          s_outs.front()->get_clear_value_vec(&values, &bitlen, &nvals);
+          match_bits->assign((nvals + 7) / 8, 0);
+          for (auto i = 0u; i < nvals; ++i) {
+            match_bits->at(i / 8) |= static_cast<uint8_t>((values[i] & 1) << (i % 8));
+          }
+          free(values);
+        } else {
+          for (const auto &s_out : s_outs) {
+            context.outputs.push_back(s_out->get_clear_value<uint64_t>());
+          }
+        }
+      });
+  return context.outputs.empty() ? 0 : context.outputs.front();
+}
+
+void AnalyticsCircuitSession::ExecuteShard(std::vector<uint64_t> &bins,
+                                           PsiAnalyticsContext &context,
+                                           std::vector<uint64_t> &payload_bins,
+                                           std::vector<uint64_t> &aggregate_shares) {
+  Run(
+      context, [&]() { return BuildAnalyticsCircuit(*party_, bins, context, payload_bins, true); },
+      [&](const std::vector<share_ptr> &s_outs) {
+        aggregate_shares.resize(s_outs.size(), 0);
+        // the arithmetic shares are additive modulo 2^64, just like the uint64_t additions
+        for (auto i = 0ull; i < s_outs.size(); ++i) {
+          aggregate_shares.at(i) += s_outs.at(i)->get_clear_value<uint64_t>();
+        }
+      });
+}
+
+uint64_t AnalyticsCircuitSession::ExecuteCombination(const std::vector<uint64_t> &aggregate_shares,
+                                                     PsiAnalyticsContext &context,
+                                                     uint64_t max_sum) {
+  context.outputs.clear();
+  Run(
+      context,
+      [&]() { return BuildShardCombinationCircuit(*party_, aggregate_shares, context, max_sum); },
+      [&](const std::vector<share_ptr> &s_outs) {
+        for (const auto &s_out : s_outs) {
+          context.outputs.push_back(s_out->get_clear_value<uint64_t>());
+        }
+      });
+  return context.outputs.empty() ? 0 : context.outputs.front();
+}
+
+}
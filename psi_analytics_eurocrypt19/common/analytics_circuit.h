@@ -0,0 +1,123 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "abycore/aby/abyparty.h"
+#include "abycore/circuit/arithmeticcircuits.h"
+#include "abycore/circuit/booleancircuits.h"
+#include "abycore/circuit/share.h"
+#include "psi_analytics_context.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ENCRYPTO {
+
+using share_ptr = std::shared_ptr<share>;
+
+// Shares the OPPRF outputs of all bins in ABY, compares them and puts the analytics function on
+// top. All gates operate on SIMD shares, so the number of gates does not grow with the number of
+// bins. Returns the output shares in the order of PsiAnalyticsContext::outputs, i.e., none for
+// NONE. For MATCH_SHARES, the only output share holds this party's shares of the equality bits.
+// For PAYLOAD_SUM, payload_bins holds the masked payloads (client) or the payload masks (server).
+// If shared_aggregates is set, the circuit stops at the aggregates of the bins, i.e., the number of
+// matches, the payload sum or the counts of the categories, and outputs this party's arithmetic
+// shares of them instead, which is what every shard of a sharded run computes.
+std::vector<share_ptr> BuildAnalyticsCircuit(ABYParty &party, std::vector<uint64_t> &bins,
+                                             const PsiAnalyticsContext &context,
+                                             std::vector<uint64_t> &payload_bins,
+                                             bool shared_aggregates = false);
+
+// Applies the analytics function to aggregates that are given as arithmetic shares, i.e., the sums
+// of the shares of all shards, and reveals the outputs in the same order as BuildAnalyticsCircuit;
+// max_sum bounds the number of matches for the comparisons with the thresholds
+std::vector<share_ptr> BuildShardCombinationCircuit(ABYParty &party,
+                                                    const std::vector<uint64_t> &aggregate_shares,
+                                                    const PsiAnalyticsContext &context,
+                                                    uint64_t max_sum);
+
+// sums up the SIMD values of an arithmetic share using O(log(nvals)) (free) addition gates
+share_ptr PutSIMDSumGate(ArithmeticCircuit *ac, share_ptr s_values);
+
+// keeps only the lowest bitlen bits of a Boolean share
+share_ptr PutLowerBitsGate(Circuit *circ, share_ptr s_in, uint32_t bitlen);
+
+// An ABY party that is kept alive across queries, so that the connection and the base OTs are
+// set up only once. ABY deletes the gates on reset, hence the circuit is rebuilt for every query,
+// which is cheap since it consists of a constant number of SIMD gates.
+//
+// The queries are split into an input-independent preparation and an online step. Prepare() can
+// run ahead of or concurrently with the OPPRF, Execute() only needs the OPPRF outputs.
+class AnalyticsCircuitSession {
+ public:
+  explicit AnalyticsCircuitSession(const PsiAnalyticsContext &context);
+
+  // connects to the other party and runs the base OTs of ABY if this was not done yet;
+  // returns the time spent in this call in milliseconds
+  double Prepare();
+
+  // gives up on the session, e.g., after the OPPRF failed: a concurrent Prepare of the server
+  // that waits for the client to connect is ended, and the party and its connection are closed,
+  // so that the other party does not wait for this one either; later queries throw
+  void Abort();
+
+  // builds and executes the circuit on the OPPRF outputs of the bins, then resets the party;
+  // all outputs are stored in context.outputs and the first one is returned. For MATCH_SHARES,
+  // the bit-packed shares are written to match_bits instead and 0 is returned
+  uint64_t Execute(std::vector<uint64_t> &bins, PsiAnalyticsContext &context,
+                   std::vector<uint64_t> &payload_bins,
+                   std::vector<uint8_t> *match_bits = nullptr);
+
+  // executes the circuit of one shard and adds this party's shares of its aggregates to
+  // aggregate_shares, which is resized on the first shard
+  void ExecuteShard(std::vector<uint64_t> &bins, PsiAnalyticsContext &context,
+                    std::vector<uint64_t> &payload_bins, std::vector<uint64_t> &aggregate_shares);
+
+  // reveals the outputs for the aggregates of all shards like Execute
+  uint64_t ExecuteCombination(const std::vector<uint64_t> &aggregate_shares,
+                              PsiAnalyticsContext &context, uint64_t max_sum);
+
+  std::size_t GetNumOfQueries() const { return nqueries_; }
+
+ private:
+  // builds a circuit, executes it, hands the output shares to read_outputs and resets the party
+  void Run(PsiAnalyticsContext &context, const std::function<std::vector<share_ptr>()> &build,
+           const std::function<void(const std::vector<share_ptr> &)> &read_outputs);
+
+  std::unique_ptr<ABYParty> party_;
+  uint32_t role_;
+  std::string address_;
+  uint16_t port_;
+  uint64_t nthreads_;
+  std::size_t nqueries_ = 0;
+
+  std::mutex preparation_mutex_;
+  bool prepared_ = false;
+  double base_ots_duration_ = 0;
+  PsiAnalyticsContext::Communication base_ots_communication_;
+};
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+namespace ENCRYPTO {
+
+// Contiguous (CSR) layout of a table with a variable number of elements per bin, e.g., the
+// server's simple table or the OPRF outputs of its elements: the elements of bin i are
+// elements[offsets[i], offsets[i + 1]). Unlike a vector per bin, it needs two allocations for
+// the whole table and can be read in place by every stage that walks the bins in order.
+struct BinnedElements {
+  std::vector<uint64_t> offsets{0};
+  std::vector<uint64_t> elements;
+
+  std::size_t GetNumOfBins() const { return offsets.size() - 1; }
+  std::size_t GetBinSize(std::size_t bin) const { return offsets[bin + 1] - offsets[bin]; }
+
+  const uint64_t *BinBegin(std::size_t bin) const { return elements.data() + offsets[bin]; }
+  const uint64_t *BinEnd(std::size_t bin) const { return elements.data() + offsets[bin + 1]; }
+
+  template <typename Iterator>
+  void AppendBin(Iterator first, Iterator last) {
+    elements.insert(elements.end(), first, last);
+    offsets.push_back(elements.size());
+  }
+
+  bool operator==(const BinnedElements &other) const {
+    return offsets == other.offsets && elements == other.elements;
+  }
+};
+
+}
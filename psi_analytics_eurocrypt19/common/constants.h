@@ -27,4 +27,8 @@ namespace ENCRYPTO {
 constexpr uint64_t __61_bit_mask = 0x1FFFFFFFFFFFFFFFull;
 constexpr std::size_t symsecbits = 128;
 
+// the OPPRF sockets use the base port, libOTe and ABY use the following offsets
+constexpr uint16_t libote_port_offset = 1;
+constexpr uint16_t aby_port_offset = 2;
+
 }
\ No newline at end of file
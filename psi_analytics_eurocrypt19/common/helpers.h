@@ -22,14 +22,38 @@
 // OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
-#include <vector>
+#include <algorithm>
 #include <cinttypes>
+#include <future>
+#include <vector>
 
 namespace ENCRYPTO {
 
+// n distinct random elements of bitlen bits, mapped to 61-bit hashes, see PreprocessElements
 std::vector<uint64_t> GeneratePseudoRandomElements(const std::size_t n, const std::size_t bitlen,
-                                                   const std::size_t seed = 12345);
+                                                   const std::size_t seed = 12345,
+                                                   const std::size_t nthreads = 1);
 
 std::vector<uint64_t> GenerateSequentialElements(const std::size_t n);
 
+// calls f(i) for all i in [0, n) on up to nthreads threads; thread t gets i = t, t + nthreads, ...
+template <typename F>
+void ParallelFor(std::size_t n, std::size_t nthreads, const F &f) {
+  nthreads = std::max<std::size_t>(std::min<std::size_t>(nthreads, n), 1);
+  std::vector<std::future<void>> workers;
+  for (auto t = 1ull; t < nthreads; ++t) {
+    workers.push_back(std::async(std::launch::async, [&f, n, nthreads, t]() {
+      for (auto i = t; i < n; i += nthreads) {
+        f(i);
+      }
+    }));
+  }
+  for (auto i = 0ull; i < n; i += nthreads) {
+    f(i);
+  }
+  for (auto &worker : workers) {
+    worker.get();
+  }
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,291 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "input_reader.h"
+#include "constants.h"
+#include "helpers.h"
+#include "preprocessing.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wmmintrin.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace ENCRYPTO {
+
+namespace {
+
+// number of records that are hashed at once, so that the AES rounds of independent records
+// fill the pipeline of the AES unit
+constexpr std::size_t nlanes = 4;
+
+struct Record {
+  const uint8_t *data;
+  std::size_t size;
+};
+
+// read-only mapping of a whole file
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Could not open " + path);
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+      close(fd);
+      throw std::runtime_error("Could not stat " + path);
+    }
+    size_ = static_cast<std::size_t>(status.st_size);
+    if (size_ > 0) {
+      void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Could not map " + path);
+      }
+      madvise(data, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const uint8_t *>(data);
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_) {
+      munmap(const_cast<uint8_t *>(data_), size_);
+    }
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+ private:
+  const uint8_t *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+template <int rcon>
+__m128i NextRoundKey(__m128i key) {
+  const auto generated = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(key, rcon), 0xff);
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, generated);
+}
+
+struct RoundKeys {
+  __m128i keys[11];
+
+  RoundKeys() {
+    // the fractional digits of pi, any public constant works
+    keys[0] = _mm_set_epi64x(0x243f6a8885a308d3ll, 0x13198a2e03707344ll);
+    keys[1] = NextRoundKey<0x01>(keys[0]);
+    keys[2] = NextRoundKey<0x02>(keys[1]);
+    keys[3] = NextRoundKey<0x04>(keys[2]);
+    keys[4] = NextRoundKey<0x08>(keys[3]);
+    keys[5] = NextRoundKey<0x10>(keys[4]);
+    keys[6] = NextRoundKey<0x20>(keys[5]);
+    keys[7] = NextRoundKey<0x40>(keys[6]);
+    keys[8] = NextRoundKey<0x80>(keys[7]);
+    keys[9] = NextRoundKey<0x1b>(keys[8]);
+    keys[10] = NextRoundKey<0x36>(keys[9]);
+  }
+};
+
+const RoundKeys round_keys;
+
+// encrypts all lanes round by round, so that the lanes are independent in the pipeline
+template <std::size_t n>
+void Encrypt(__m128i (&blocks)[n]) {
+  for (auto &block : blocks) {
+    block = _mm_xor_si128(block, round_keys.keys[0]);
+  }
+  for (auto round = 1; round < 10; ++round) {
+    for (auto &block : blocks) {
+      block = _mm_aesenc_si128(block, round_keys.keys[round]);
+    }
+  }
+  for (auto &block : blocks) {
+    block = _mm_aesenclast_si128(block, round_keys.keys[10]);
+  }
+}
+
+// block i of a record, the last one is padded with zeros
+__m128i LoadBlock(const Record &record, std::size_t i) {
+  const auto offset = i * sizeof(__m128i);
+  if (offset + sizeof(__m128i) <= record.size) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(record.data + offset));
+  }
+  alignas(16) uint8_t padded[sizeof(__m128i)] = {};
+  if (offset < record.size) {
+    std::memcpy(padded, record.data + offset, record.size - offset);
+  }
+  return _mm_load_si128(reinterpret_cast<const __m128i *>(padded));
+}
+
+// h = AES(h ^ m) ^ m for every block m starting with h = length, finalized by AES(h) ^ h
+template <std::size_t n>
+void HashLanes(const Record *records, uint64_t *hashes) {
+  __m128i states[n], blocks[n], messages[n];
+  std::size_t nblocks[n], max_nblocks = 0;
+  for (auto lane = 0ull; lane < n; ++lane) {
+    states[lane] = _mm_set_epi64x(0, static_cast<long long>(records[lane].size));
+    nblocks[lane] = (records[lane].size + sizeof(__m128i) - 1) / sizeof(__m128i);
+    max_nblocks = std::max(max_nblocks, nblocks[lane]);
+  }
+
+  for (auto i = 0ull; i < max_nblocks; ++i) {
+    for (auto lane = 0ull; lane < n; ++lane) {
+      messages[lane] = LoadBlock(records[lane], i);
+      blocks[lane] = _mm_xor_si128(states[lane], messages[lane]);
+    }
+    Encrypt(blocks);
+    for (auto lane = 0ull; lane < n; ++lane) {
+      if (i < nblocks[lane]) {
+        states[lane] = _mm_xor_si128(blocks[lane], messages[lane]);
+      }
+    }
+  }
+
+  for (auto lane = 0ull; lane < n; ++lane) {
+    blocks[lane] = states[lane];
+  }
+  Encrypt(blocks);
+  for (auto lane = 0ull; lane < n; ++lane) {
+    const auto hash = _mm_xor_si128(blocks[lane], states[lane]);
+    hashes[lane] = static_cast<uint64_t>(_mm_cvtsi128_si64(hash)) & __61_bit_mask;
+  }
+}
+
+// hashes the records nlanes at a time
+void HashRecords(const Record *records, std::size_t n, std::vector<uint64_t> &hashes) {
+  const auto offset = hashes.size();
+  hashes.resize(offset + n);
+  auto i = 0ull;
+  for (; i + nlanes <= n; i += nlanes) {
+    HashLanes<nlanes>(records + i, hashes.data() + offset + i);
+  }
+  for (; i < n; ++i) {
+    HashLanes<1>(records + i, hashes.data() + offset + i);
+  }
+}
+
+// hashes the lines that start in [begin, end), a line that starts before begin belongs to the
+// previous range
+void HashLines(const MappedFile &file, std::size_t begin, std::size_t end,
+               std::vector<uint64_t> &hashes) {
+  const auto data = file.data();
+  if (begin > 0 && data[begin - 1] != '\n') {
+    const auto newline = std::memchr(data + begin, '\n', file.size() - begin);
+    begin = newline ? static_cast<const uint8_t *>(newline) - data + 1 : file.size();
+  }
+
+  std::vector<Record> records;
+  records.reserve(1024);
+  while (begin < end) {
+    const auto newline = std::memchr(data + begin, '\n', file.size() - begin);
+    const std::size_t line_end =
+        newline ? static_cast<const uint8_t *>(newline) - data : file.size();
+    auto size = line_end - begin;
+    if (size > 0 && data[line_end - 1] == '\r') {
+      --size;
+    }
+    if (size > 0) {
+      records.push_back({data + begin, size});
+    }
+    if (records.size() == records.capacity()) {
+      HashRecords(records.data(), records.size(), hashes);
+      records.clear();
+    }
+    begin = line_end + 1;
+  }
+  HashRecords(records.data(), records.size(), hashes);
+}
+
+std::vector<Record> IndexLengthPrefixedRecords(const MappedFile &file) {
+  std::vector<Record> records;
+  for (std::size_t offset = 0; offset < file.size();) {
+    uint32_t size;
+    if (file.size() - offset < sizeof(size)) {
+      throw std::runtime_error("Truncated record length");
+    }
+    std::memcpy(&size, file.data() + offset, sizeof(size));
+    offset += sizeof(size);
+    if (file.size() - offset < size) {
+      throw std::runtime_error("Truncated record");
+    }
+    records.push_back({file.data() + offset, size});
+    offset += size;
+  }
+  return records;
+}
+
+}  // namespace
+
+uint64_t HashRecord(const uint8_t *data, std::size_t size) {
+  const Record record{data, size};
+  uint64_t hash;
+  HashLanes<1>(&record, &hash);
+  return hash;
+}
+
+std::vector<uint64_t> ReadElementsFromFile(const std::string &path, RecordFormat format,
+                                           std::size_t nthreads) {
+  const MappedFile file(path);
+  nthreads = std::max<std::size_t>(nthreads, 1);
+  std::vector<std::vector<uint64_t>> hashes(nthreads);
+
+  if (format == RecordFormat::LINES) {
+    ParallelFor(nthreads, nthreads, [&](std::size_t t) {
+      HashLines(file, file.size() * t / nthreads, file.size() * (t + 1) / nthreads, hashes.at(t));
+    });
+  } else {
+    const auto records = IndexLengthPrefixedRecords(file);
+    ParallelFor(nthreads, nthreads, [&](std::size_t t) {
+      const auto begin = records.size() * t / nthreads, end = records.size() * (t + 1) / nthreads;
+      HashRecords(records.data() + begin, end - begin, hashes.at(t));
+    });
+  }
+
+  std::size_t nelements = 0;
+  for (const auto &thread_hashes : hashes) {
+    nelements += thread_hashes.size();
+  }
+  std::vector<uint64_t> elements;
+  elements.reserve(nelements);
+  for (const auto &thread_hashes : hashes) {
+    elements.insert(elements.end(), thread_hashes.begin(), thread_hashes.end());
+  }
+  SortUnique(elements, nthreads);
+  return elements;
+}
+
+}
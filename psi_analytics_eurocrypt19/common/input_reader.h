@@ -0,0 +1,49 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ENCRYPTO {
+
+enum class RecordFormat {
+  LINES,           // one record per line, "\n" or "\r\n", empty lines are skipped
+  LENGTH_PREFIXED  // every record is preceded by its length as a little-endian uint32_t
+};
+
+// Reads the records, e.g., e-mail addresses or device IDs, from a memory-mapped file and hashes
+// every record to a 61-bit element with HashRecord. The records are hashed by nthreads threads.
+// Returns the sorted elements without duplicates.
+std::vector<uint64_t> ReadElementsFromFile(const std::string &path, RecordFormat format,
+                                           std::size_t nthreads = 1);
+
+// Fixed-key AES-128 compression of the 16-byte blocks of the record, padded with zeros and
+// finalized with its length, truncated to 61 bits. Both parties have to hash their records
+// with the same function. Distinct records collide with probability 2^-61 per pair, i.e.,
+// collisions are only expected beyond 2^30 records.
+uint64_t HashRecord(const uint8_t *data, std::size_t size);
+
+}
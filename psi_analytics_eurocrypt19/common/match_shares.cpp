@@ -0,0 +1,126 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "match_shares.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace ENCRYPTO {
+
+namespace {
+
+constexpr char match_shares_magic[8] = {'P', 'S', 'I', 'M', 'A', 'T', 'C', 'H'};
+constexpr uint32_t match_shares_version = 1;
+
+template <typename T>
+void Append(std::vector<uint8_t> &buffer, const T *values, std::size_t n) {
+  const auto bytes = reinterpret_cast<const uint8_t *>(values);
+  buffer.insert(buffer.end(), bytes, bytes + n * sizeof(T));
+}
+
+template <typename T>
+void Extract(const std::vector<uint8_t> &buffer, std::size_t &offset, T *values, std::size_t n) {
+  if (n > (buffer.size() - offset) / sizeof(T)) {
+    throw std::runtime_error("Truncated match shares");
+  }
+  std::memcpy(values, buffer.data() + offset, n * sizeof(T));
+  offset += n * sizeof(T);
+}
+
+}  // namespace
+
+std::vector<uint8_t> SerializeMatchShares(const MatchShares &shares) {
+  if (shares.bits.size() != (shares.nbins + 7) / 8 || shares.offsets.size() != shares.nbins + 1 ||
+      shares.offsets.back() != shares.elements.size()) {
+    throw std::runtime_error("Inconsistent match shares");
+  }
+
+  const uint64_t nelements = shares.elements.size();
+  std::vector<uint8_t> buffer;
+  buffer.reserve(sizeof(match_shares_magic) + 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t) +
+                 shares.bits.size() + (shares.offsets.size() + nelements) * sizeof(uint64_t));
+  Append(buffer, match_shares_magic, sizeof(match_shares_magic));
+  Append(buffer, &match_shares_version, 1);
+  Append(buffer, &shares.role, 1);
+  Append(buffer, &shares.nbins, 1);
+  Append(buffer, &nelements, 1);
+  Append(buffer, shares.bits.data(), shares.bits.size());
+  Append(buffer, shares.offsets.data(), shares.offsets.size());
+  Append(buffer, shares.elements.data(), shares.elements.size());
+  return buffer;
+}
+
+MatchShares DeserializeMatchShares(const std::vector<uint8_t> &buffer) {
+  std::size_t offset = 0;
+  char magic[sizeof(match_shares_magic)];
+  uint32_t version;
+  Extract(buffer, offset, magic, sizeof(magic));
+  Extract(buffer, offset, &version, 1);
+  if (std::memcmp(magic, match_shares_magic, sizeof(match_shares_magic)) != 0 || version != match_shares_version) {
+    throw std::runtime_error("Unknown match shares format");
+  }
+
+  MatchShares shares;
+  uint64_t nelements;
+  Extract(buffer, offset, &shares.role, 1);
+  Extract(buffer, offset, &shares.nbins, 1);
+  Extract(buffer, offset, &nelements, 1);
+  if (shares.nbins > buffer.size() * 8 || nelements > buffer.size() / sizeof(uint64_t)) {
+    throw std::runtime_error("Truncated match shares");
+  }
+
+  shares.bits.resize((shares.nbins + 7) / 8);
+  shares.offsets.resize(shares.nbins + 1);
+  shares.elements.resize(nelements);
+  Extract(buffer, offset, shares.bits.data(), shares.bits.size());
+  Extract(buffer, offset, shares.offsets.data(), shares.offsets.size());
+  Extract(buffer, offset, shares.elements.data(), shares.elements.size());
+  if (shares.offsets.back() != nelements) {
+    throw std::runtime_error("Inconsistent match shares");
+  }
+  return shares;
+}
+
+void WriteMatchShares(const MatchShares &shares, const std::string &path) {
+  const auto buffer = SerializeMatchShares(shares);
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+  if (!file) {
+    throw std::runtime_error("Could not write the match shares to " + path);
+  }
+}
+
+MatchShares ReadMatchShares(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Could not open " + path);
+  }
+  std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(file)),
+                              std::istreambuf_iterator<char>());
+  return DeserializeMatchShares(buffer);
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+namespace ENCRYPTO {
+
+// One party's output of a PSI run that stops after the equality checks: XOR shares of the match
+// bit of every bin together with the elements that this party hashed to each bin. Combining the
+// shares of both parties yields 1 for the bins where the client's element is in the intersection.
+// Later (MPC) analytics can operate on the shares instead of repeating the PSI for every query.
+struct MatchShares {
+  uint32_t role;
+  uint64_t nbins = 0;
+  std::vector<uint8_t> bits;  //< bit-packed shares, bin i is bit (i % 8) of byte (i / 8)
+
+  // elements of bin i are elements[offsets[i], offsets[i + 1]), i.e., at most one for the client
+  std::vector<uint64_t> offsets;
+  std::vector<uint64_t> elements;
+
+  bool GetShare(std::size_t bin) const { return (bits.at(bin / 8) >> (bin % 8)) & 1; }
+};
+
+// Compact binary format: the magic "PSIMATCH", a version, the role, nbins and the number of
+// elements followed by the packed bits, the offsets and the elements. Integers are stored in the
+// byte order of the host.
+std::vector<uint8_t> SerializeMatchShares(const MatchShares &shares);
+
+MatchShares DeserializeMatchShares(const std::vector<uint8_t> &buffer);
+
+void WriteMatchShares(const MatchShares &shares, const std::string &path);
+
+MatchShares ReadMatchShares(const std::string &path);
+
+}
@@ -0,0 +1,271 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <string>
+
+#ifdef PSI_ANALYTICS_TRACK_ALLOCATIONS
+#include <malloc.h>
+#endif
+
+namespace {
+
+std::atomic<uint64_t> allocations{0}, allocated_bytes{0}, heap_bytes{0};
+
+#ifdef PSI_ANALYTICS_TRACK_ALLOCATIONS
+
+// the heap peaks of the phases that are measured right now, one bit per used slot
+std::atomic<uint64_t> used_phase_slots{0};
+std::atomic<uint64_t> phase_heap_peaks[64];
+
+void RaisePhasePeaks(uint64_t heap_size) {
+  for (auto slots = used_phase_slots.load(std::memory_order_relaxed); slots != 0;
+       slots &= slots - 1) {
+    auto &peak = phase_heap_peaks[__builtin_ctzll(slots)];
+    auto current = peak.load(std::memory_order_relaxed);
+    while (current < heap_size &&
+           !peak.compare_exchange_weak(current, heap_size, std::memory_order_relaxed)) {
+    }
+  }
+}
+
+// the heap size counts the usable sizes of the blocks, which malloc_usable_size also knows when
+// they are freed without a size
+void CountAllocation(void *pointer, std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  const auto block_size = malloc_usable_size(pointer);
+  RaisePhasePeaks(heap_bytes.fetch_add(block_size, std::memory_order_relaxed) + block_size);
+}
+
+void *CountedAllocation(std::size_t size) {
+  while (true) {
+    if (auto pointer = std::malloc(size == 0 ? 1 : size)) {
+      CountAllocation(pointer, size);
+      return pointer;
+    }
+    auto handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void CountedFree(void *pointer) noexcept {
+  if (pointer) {
+    heap_bytes.fetch_sub(malloc_usable_size(pointer), std::memory_order_relaxed);
+    std::free(pointer);
+  }
+}
+
+#ifdef __cpp_aligned_new
+void *CountedAlignedAllocation(std::size_t size, std::align_val_t alignment) {
+  const auto alignment_bytes = std::max(static_cast<std::size_t>(alignment), sizeof(void *));
+  while (true) {
+    void *pointer = nullptr;
+    if (posix_memalign(&pointer, alignment_bytes, size == 0 ? 1 : size) == 0) {
+      CountAllocation(pointer, size);
+      return pointer;
+    }
+    auto handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+#endif
+
+#endif
+
+ENCRYPTO::MemoryUsage SampleMemoryUsage(uint64_t &rss_hwm_bytes) {
+  ENCRYPTO::MemoryUsage usage;
+  usage.allocations = allocations.load(std::memory_order_relaxed);
+  usage.allocated_bytes = allocated_bytes.load(std::memory_order_relaxed);
+  usage.heap_bytes = heap_bytes.load(std::memory_order_relaxed);
+
+  // the lines look like "VmHWM:    123456 kB"
+  std::ifstream status("/proc/self/status");
+  std::string key;
+  uint64_t kilobytes;
+  while (status >> key) {
+    if (key == "VmHWM:" && status >> kilobytes) {
+      rss_hwm_bytes = kilobytes * 1024;
+    } else if (key == "VmRSS:" && status >> kilobytes) {
+      usage.rss_bytes = kilobytes * 1024;
+    }
+    status.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+  return usage;
+}
+
+}  // namespace
+
+#ifdef PSI_ANALYTICS_TRACK_ALLOCATIONS
+
+// the counters are process-wide, i.e., they include the allocations of libOTe, ABY and of all
+// threads; the other party's allocations are only included if it runs in the same process
+void *operator new(std::size_t size) { return CountedAllocation(size); }
+void *operator new[](std::size_t size) { return CountedAllocation(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return CountedAllocation(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return CountedAllocation(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void *pointer) noexcept { CountedFree(pointer); }
+void operator delete[](void *pointer) noexcept { CountedFree(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { CountedFree(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept { CountedFree(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { CountedFree(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { CountedFree(pointer); }
+
+// the over-aligned types, e.g., the blocks of libOTe, go through these
+#ifdef __cpp_aligned_new
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return CountedAlignedAllocation(size, alignment);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return CountedAlignedAllocation(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept {
+  try {
+    return CountedAlignedAllocation(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept {
+  try {
+    return CountedAlignedAllocation(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept { CountedFree(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { CountedFree(pointer); }
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept {
+  CountedFree(pointer);
+}
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept {
+  CountedFree(pointer);
+}
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept {
+  CountedFree(pointer);
+}
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept {
+  CountedFree(pointer);
+}
+#endif
+
+#endif
+
+namespace ENCRYPTO {
+
+MemoryUsage &MemoryUsage::operator+=(const MemoryUsage &other) {
+  allocations += other.allocations;
+  allocated_bytes += other.allocated_bytes;
+  heap_bytes = std::max(heap_bytes, other.heap_bytes);
+  heap_peak_bytes = std::max(heap_peak_bytes, other.heap_peak_bytes);
+  rss_bytes = std::max(rss_bytes, other.rss_bytes);
+  rss_hwm_increase_bytes = std::max(rss_hwm_increase_bytes, other.rss_hwm_increase_bytes);
+  return *this;
+}
+
+MemoryPhase::MemoryPhase() : start_(SampleMemoryUsage(start_rss_hwm_bytes_)), slot_(-1) {
+#ifdef PSI_ANALYTICS_TRACK_ALLOCATIONS
+  // claim a free slot and start its peak at the current heap size
+  auto slots = used_phase_slots.load(std::memory_order_relaxed);
+  while (~slots != 0) {
+    const auto slot = __builtin_ctzll(~slots);
+    phase_heap_peaks[slot].store(start_.heap_bytes, std::memory_order_relaxed);
+    if (used_phase_slots.compare_exchange_weak(slots, slots | (1ull << slot))) {
+      slot_ = slot;
+      break;
+    }
+  }
+#endif
+}
+
+MemoryPhase::MemoryPhase(MemoryPhase &&other) noexcept
+    : start_rss_hwm_bytes_(other.start_rss_hwm_bytes_), start_(other.start_), slot_(other.slot_) {
+  other.slot_ = -1;
+}
+
+MemoryPhase::~MemoryPhase() {
+#ifdef PSI_ANALYTICS_TRACK_ALLOCATIONS
+  if (slot_ >= 0) {
+    used_phase_slots.fetch_and(~(1ull << slot_));
+  }
+#endif
+}
+
+MemoryUsage MemoryPhase::End() const {
+  uint64_t rss_hwm_bytes = 0;
+  auto usage = SampleMemoryUsage(rss_hwm_bytes);
+  usage.allocations -= start_.allocations;
+  usage.allocated_bytes -= start_.allocated_bytes;
+  usage.heap_peak_bytes = std::max(start_.heap_bytes, usage.heap_bytes);
+#ifdef PSI_ANALYTICS_TRACK_ALLOCATIONS
+  if (slot_ >= 0) {
+    usage.heap_peak_bytes =
+        std::max(usage.heap_peak_bytes, phase_heap_peaks[slot_].load(std::memory_order_relaxed));
+  }
+#endif
+  usage.rss_hwm_increase_bytes = rss_hwm_bytes - std::min(start_rss_hwm_bytes_, rss_hwm_bytes);
+  return usage;
+}
+
+bool AllocationTrackingEnabled() {
+#ifdef PSI_ANALYTICS_TRACK_ALLOCATIONS
+  return true;
+#else
+  return false;
+#endif
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cinttypes>
+
+namespace ENCRYPTO {
+
+// memory usage of a phase, see MetricsRegistry::TrackMemory
+struct MemoryUsage {
+  uint64_t allocations = 0;      //< calls of operator new during the phase
+  uint64_t allocated_bytes = 0;  //< bytes requested from operator new during the phase
+  uint64_t heap_bytes = 0;       //< live heap bytes at the end of the phase
+  uint64_t heap_peak_bytes = 0;  //< largest number of live heap bytes during the phase
+  uint64_t rss_bytes = 0;        //< resident set size (VmRSS) at the end of the phase
+  uint64_t rss_hwm_increase_bytes = 0;  //< growth of the peak RSS (VmHWM) during the phase
+
+  // adds the allocations of other and keeps the larger sizes and peaks, e.g., for the shards of
+  // a run
+  MemoryUsage &operator+=(const MemoryUsage &other);
+};
+
+// Measures the memory usage of a phase from its construction until End. The allocation counters
+// and the heap sizes are only maintained if the library was built with
+// PSI_ANALYTICS_TRACK_ALLOCATIONS, which replaces the global operator new, and are 0 otherwise.
+// They are process-wide, i.e., they include all threads, but every phase has its own heap peak,
+// so that nested and concurrent phases do not reset each other's peaks; up to 64 phases can be
+// measured at the same time, the peak of further ones is the larger heap size at their start and
+// end. The RSS is read from /proc/self/status, and since the kernel only keeps the peak RSS of
+// the whole process, a phase records by how much it raised that peak.
+class MemoryPhase {
+ public:
+  MemoryPhase();
+  MemoryPhase(MemoryPhase &&other) noexcept;
+  MemoryPhase(const MemoryPhase &) = delete;
+  MemoryPhase &operator=(const MemoryPhase &) = delete;
+  ~MemoryPhase();
+
+  // the usage since the construction; later calls measure up to their time, too
+  MemoryUsage End() const;
+
+ private:
+  uint64_t start_rss_hwm_bytes_ = 0;
+  MemoryUsage start_;
+  int slot_;
+};
+
+bool AllocationTrackingEnabled();
+
+}
@@ -0,0 +1,218 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace ENCRYPTO {
+
+namespace {
+
+using duration_millis = std::chrono::duration<double, std::milli>;
+
+using Phases = std::vector<std::pair<std::string, double>>;
+using MemoryUsages = std::vector<std::pair<std::string, MemoryUsage>>;
+
+// the entry of the phase in phases or memory usages, end() if there is none
+template <typename Entries>
+auto Find(Entries &entries, const std::string &phase) -> decltype(entries.begin()) {
+  return std::find_if(entries.begin(), entries.end(), [&](const typename Entries::value_type &e) {
+    return e.first == phase;
+  });
+}
+
+// writes the sub-phases of prefix, which is empty or ends with '/'
+void WritePhases(std::ostream &json, const Phases &phases, const MemoryUsages &memory_usages,
+                 const std::string &prefix) {
+  std::vector<std::string> children;
+  for (const auto &phase : phases) {
+    if (phase.first.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+    const auto child = phase.first.substr(prefix.size(), phase.first.find('/', prefix.size()) -
+                                                             prefix.size());
+    if (std::find(children.begin(), children.end(), child) == children.end()) {
+      children.push_back(child);
+    }
+  }
+
+  json << '{';
+  for (auto i = 0ull; i < children.size(); ++i) {
+    const auto path = prefix + children.at(i);
+    json << (i == 0 ? "" : ", ") << '"' << children.at(i) << "\": {";
+    const auto timed = Find(phases, path);
+    if (timed != phases.end()) {
+      json << "\"ms\": " << timed->second;
+    }
+    const auto measured = Find(memory_usages, path);
+    if (measured != memory_usages.end()) {
+      const auto &usage = measured->second;
+      json << (timed != phases.end() ? ", " : "")
+           << "\"memory\": {\"allocations\": " << usage.allocations
+           << ", \"allocated_bytes\": " << usage.allocated_bytes
+           << ", \"heap_bytes\": " << usage.heap_bytes
+           << ", \"heap_peak_bytes\": " << usage.heap_peak_bytes
+           << ", \"rss_bytes\": " << usage.rss_bytes
+           << ", \"rss_hwm_increase_bytes\": " << usage.rss_hwm_increase_bytes << '}';
+    }
+    const bool has_children =
+        std::any_of(phases.begin(), phases.end(), [&](const Phases::value_type &p) {
+          return p.first.compare(0, path.size() + 1, path + '/') == 0;
+        });
+    if (has_children) {
+      json << (timed != phases.end() || measured != memory_usages.end() ? ", " : "")
+           << "\"phases\": ";
+      WritePhases(json, phases, memory_usages, path + '/');
+    }
+    json << '}';
+  }
+  json << '}';
+}
+
+}  // namespace
+
+MetricsRegistry::PhaseTimer::PhaseTimer(MetricsRegistry &registry, std::string phase)
+    : registry_(&registry), phase_(std::move(phase)) {
+  if (registry.TracksMemory()) {
+    memory_ = std::make_unique<MemoryPhase>();
+  }
+  if (auto trace = registry_->GetTrace()) {
+    trace->Begin(phase_, "phase");
+  }
+  start_ = Clock::now();
+}
+
+MetricsRegistry::PhaseTimer::PhaseTimer(PhaseTimer &&other) noexcept
+    : registry_(other.registry_),
+      phase_(std::move(other.phase_)),
+      start_(other.start_),
+      memory_(std::move(other.memory_)) {
+  other.registry_ = nullptr;
+}
+
+MetricsRegistry::PhaseTimer::~PhaseTimer() { Stop(); }
+
+double MetricsRegistry::PhaseTimer::Stop() {
+  if (!registry_) {
+    return 0;
+  }
+  const duration_millis duration = Clock::now() - start_;
+  if (auto trace = registry_->GetTrace()) {
+    trace->End(phase_, "phase");
+  }
+  registry_->Add(phase_, duration.count());
+  if (memory_) {
+    registry_->AddMemoryUsage(phase_, memory_->End());
+    memory_.reset();
+  }
+  registry_ = nullptr;
+  return duration.count();
+}
+
+MetricsRegistry::MetricsRegistry(const MetricsRegistry &other)
+    : phases_(other.GetPhases()),
+      memory_usages_(other.GetMemoryUsages()),
+      track_memory_(other.TracksMemory()),
+      trace_(other.trace_) {}
+
+MetricsRegistry &MetricsRegistry::operator=(const MetricsRegistry &other) {
+  if (this != &other) {
+    auto phases = other.GetPhases();
+    auto memory_usages = other.GetMemoryUsages();
+    std::lock_guard<std::mutex> lock(mutex_);
+    phases_ = std::move(phases);
+    memory_usages_ = std::move(memory_usages);
+    track_memory_ = other.TracksMemory();
+    trace_ = other.trace_;
+  }
+  return *this;
+}
+
+void MetricsRegistry::Add(const std::string &phase, double milliseconds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto recorded = Find(phases_, phase);
+  if (recorded == phases_.end()) {
+    phases_.emplace_back(phase, milliseconds);
+  } else {
+    recorded->second += milliseconds;
+  }
+}
+
+void MetricsRegistry::AddMemoryUsage(const std::string &phase, const MemoryUsage &usage) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto recorded = Find(memory_usages_, phase);
+  if (recorded == memory_usages_.end()) {
+    memory_usages_.emplace_back(phase, usage);
+  } else {
+    recorded->second += usage;
+  }
+}
+
+void MetricsRegistry::Merge(const MetricsRegistry &other) {
+  for (const auto &phase : other.GetPhases()) {
+    Add(phase.first, phase.second);
+  }
+  for (const auto &phase : other.GetMemoryUsages()) {
+    AddMemoryUsage(phase.first, phase.second);
+  }
+}
+
+void MetricsRegistry::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  phases_.clear();
+  memory_usages_.clear();
+}
+
+double MetricsRegistry::Get(const std::string &phase) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto recorded = Find(phases_, phase);
+  return recorded == phases_.end() ? 0 : recorded->second;
+}
+
+std::vector<std::pair<std::string, double>> MetricsRegistry::GetPhases() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return phases_;
+}
+
+MemoryUsage MetricsRegistry::GetMemoryUsage(const std::string &phase) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto recorded = Find(memory_usages_, phase);
+  return recorded == memory_usages_.end() ? MemoryUsage() : recorded->second;
+}
+
+std::vector<std::pair<std::string, MemoryUsage>> MetricsRegistry::GetMemoryUsages() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_usages_;
+}
+
+std::string MetricsRegistry::ToJson() const {
+  std::ostringstream json;
+  json << std::setprecision(6) << std::fixed;
+  WritePhases(json, GetPhases(), GetMemoryUsages(), "");
+  return json.str();
+}
+
+}
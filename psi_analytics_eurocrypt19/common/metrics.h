@@ -0,0 +1,115 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "memory_usage.h"
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ENCRYPTO {
+
+// Registry of the phase timings of a run. Phases are named by '/'-separated paths, e.g.,
+// "opprf/polynomials" is a sub-phase of "opprf", and timed on the monotonic clock. Recording the
+// same phase again adds to it, e.g., for the shards of a run. The registry is thread-safe and
+// copies of it are independent. If TrackMemory is set, the timers also record the memory usage of
+// their phases, see memory_usage.h, and if a trace recorder is set, they emit trace events, see
+// trace.h.
+class MetricsRegistry {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // times a phase from its construction until Stop is called or it is destroyed
+  class PhaseTimer {
+   public:
+    PhaseTimer(MetricsRegistry &registry, std::string phase);
+    PhaseTimer(PhaseTimer &&other) noexcept;
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+    ~PhaseTimer();
+
+    // records the elapsed time and returns it in milliseconds; later calls return 0
+    double Stop();
+
+   private:
+    MetricsRegistry *registry_;
+    std::string phase_;
+    Clock::time_point start_;
+    std::unique_ptr<MemoryPhase> memory_;  //< only if the registry tracks memory
+  };
+
+  MetricsRegistry() = default;
+  MetricsRegistry(const MetricsRegistry &other);
+  MetricsRegistry &operator=(const MetricsRegistry &other);
+
+  PhaseTimer Time(std::string phase) { return PhaseTimer(*this, std::move(phase)); }
+
+  // adds a duration that was measured elsewhere, e.g., by ABY
+  void Add(const std::string &phase, double milliseconds);
+
+  void AddMemoryUsage(const std::string &phase, const MemoryUsage &usage);
+
+  // adds all phases of other
+  void Merge(const MetricsRegistry &other);
+
+  // clears the recorded phases, but neither whether memory is tracked nor the trace
+  void Clear();
+
+  // measuring the memory costs a read of /proc/self/status at the start and the end of each phase
+  void TrackMemory(bool track) { track_memory_ = track; }
+  bool TracksMemory() const { return track_memory_; }
+
+  // copies of the registry share the recorder, i.e., there is one per party; set before a run
+  void SetTrace(std::shared_ptr<TraceRecorder> trace) { trace_ = std::move(trace); }
+  TraceRecorder *GetTrace() const { return trace_.get(); }
+
+  // milliseconds of the phase, 0 if it was not recorded
+  double Get(const std::string &phase) const;
+
+  // (path, milliseconds) pairs in the order in which the phases were first recorded
+  std::vector<std::pair<std::string, double>> GetPhases() const;
+
+  // the memory usage of the phases that were timed while memory was tracked
+  MemoryUsage GetMemoryUsage(const std::string &phase) const;
+  std::vector<std::pair<std::string, MemoryUsage>> GetMemoryUsages() const;
+
+  // nested JSON objects, one per phase: {"<phase>": {"ms": ..., "phases": {<sub-phases>}}};
+  // "ms" is missing for phases that only have timed sub-phases; phases with a memory usage also
+  // have "memory": {"allocations": ..., "allocated_bytes": ..., "heap_peak_bytes": ..., ...}
+  std::string ToJson() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<std::pair<std::string, double>> phases_;
+  std::vector<std::pair<std::string, MemoryUsage>> memory_usages_;
+  std::atomic<bool> track_memory_{false};
+  std::shared_ptr<TraceRecorder> trace_;
+};
+
+}
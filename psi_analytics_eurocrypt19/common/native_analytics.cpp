@@ -0,0 +1,525 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "native_analytics.h"
+#include "constants.h"
+#include "network/async_network_engine.h"
+#include "ots/ots.h"
+
+#include "ENCRYPTO_utils/typedefs.h"
+#include "cryptoTools/Network/Channel.h"
+#include "cryptoTools/Network/IOService.h"
+#include "cryptoTools/Network/Session.h"
+
+#include "libOTe/Base/BaseOT.h"
+#include "libOTe/NChooseOne/Kkrt/KkrtNcoOtReceiver.h"
+#include "libOTe/NChooseOne/Kkrt/KkrtNcoOtSender.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <ratio>
+#include <stdexcept>
+#include <type_traits>
+
+namespace ENCRYPTO {
+
+using milliseconds_ratio = std::ratio<1, 1000>;
+using duration_millis = std::chrono::duration<double, milliseconds_ratio>;
+
+namespace {
+
+constexpr std::size_t chunk_bits = 4;  //< the choice of a 1-out-of-16 OT
+constexpr std::size_t nchoices = 1 << chunk_bits;
+constexpr std::size_t ot_batch_size = 1 << 16;  //< bounds the memory for the OT messages
+
+// entries of 2 bits, i.e., (greater, equal), of the millionaires' protocol
+constexpr uint8_t gt_bit = 1, eq_bit = 2;
+
+uint8_t EqualChunks(uint8_t server_chunk, uint8_t client_chunk) {
+  return server_chunk == client_chunk;
+}
+
+// (client chunk > server chunk, client chunk == server chunk)
+uint8_t CompareChunks(uint8_t server_chunk, uint8_t client_chunk) {
+  return (client_chunk > server_chunk ? gt_bit : 0) | (client_chunk == server_chunk ? eq_bit : 0);
+}
+
+uint8_t AndOfFour(uint8_t x) { return x == nchoices - 1; }
+
+// combines the (greater, equal) entries of the lower (bits 0-1) and the higher (bits 2-3) chunks
+uint8_t CombineComparisons(uint8_t x) {
+  const uint8_t lo = x & 3, hi = x >> 2;
+  const uint8_t gt = (hi & gt_bit) ^ ((hi & eq_bit) && (lo & gt_bit) ? gt_bit : 0);
+  const uint8_t eq = (hi & eq_bit) && (lo & eq_bit) ? eq_bit : 0;
+  return gt | eq;
+}
+
+// number of OTs for the equality of one pair of values and the layers of AND gates on top
+std::size_t EqualityOtsPerValue(std::size_t nchunks, bool arithmetic) {
+  std::size_t nots = nchunks;
+  for (auto width = nchunks; width > 1 || arithmetic;) {
+    width = ceil_divide(width, chunk_bits);
+    nots += width;
+    if (width == 1 && arithmetic) {
+      break;
+    }
+  }
+  return nots;
+}
+
+std::size_t ComparisonOtsPerValue(std::size_t nchunks) {
+  std::size_t nots = nchunks;
+  for (auto width = nchunks; width > 1;) {
+    width = ceil_divide(width, 2);
+    nots += width;
+  }
+  return nots;
+}
+
+}  // namespace
+
+struct NativeAnalyticsSession::State {
+  e_role role;
+  std::unique_ptr<osuCrypto::IOService> ios;  //< only without a network engine
+  std::unique_ptr<osuCrypto::Session> session;
+  osuCrypto::Channel channel;
+  osuCrypto::KkrtNcoOtSender sender;      //< used by the server
+  osuCrypto::KkrtNcoOtReceiver receiver;  //< used by the client
+  std::unique_ptr<osuCrypto::PRNG> prng;
+  std::size_t next_ot = 0;
+
+  // closes the connection if it was set up; the IOService of a network engine keeps running
+  void Close() {
+    if (session) {
+      channel.close();
+      session->stop();
+      if (ios) {
+        ios->stop();
+      }
+      channel = osuCrypto::Channel();
+      session.reset();
+      ios.reset();
+    }
+  }
+
+  // 1-out-of-16 OTs with chosen messages of msg_bytes bytes from the KKRT OPRF: the server sends
+  // message(i, v) for choice v of the i-th OT masked with the OPRF output for v
+  template <typename Message>
+  void SendChosen(std::size_t n, std::size_t msg_bytes, Message message) {
+    std::vector<uint8_t> buffer;
+    for (std::size_t offset = 0; offset < n; offset += ot_batch_size) {
+      const auto batch = std::min(ot_batch_size, n - offset);
+      sender.recvCorrection(channel, batch);
+      buffer.assign(batch * nchoices * msg_bytes, 0);
+      for (auto i = 0ull; i < batch; ++i) {
+        for (auto v = 0ull; v < nchoices; ++v) {
+          const auto input = osuCrypto::toBlock(v);
+          osuCrypto::block pad;
+          sender.encode(next_ot + offset + i, &input, &pad, sizeof(pad));
+          const uint64_t masked = message(offset + i, static_cast<uint8_t>(v)) ^
+                                  reinterpret_cast<const uint64_t *>(&pad)[0];
+          std::memcpy(buffer.data() + (i * nchoices + v) * msg_bytes, &masked, msg_bytes);
+        }
+      }
+      channel.send(buffer.data(), buffer.size());
+    }
+    next_ot += n;
+  }
+
+  // the client's side of SendChosen, on_message(i, message) gets the chosen messages
+  template <typename Sink>
+  void ReceiveChosen(const std::vector<uint8_t> &choices, std::size_t msg_bytes, Sink on_message) {
+    const auto n = choices.size();
+    const uint64_t msg_mask = msg_bytes == sizeof(uint64_t) ? ~0ull : (1ull << 8 * msg_bytes) - 1;
+    std::vector<osuCrypto::block> pads;
+    std::vector<uint8_t> buffer;
+    for (std::size_t offset = 0; offset < n; offset += ot_batch_size) {
+      const auto batch = std::min(ot_batch_size, n - offset);
+      pads.resize(batch);
+      for (auto i = 0ull; i < batch; ++i) {
+        const auto input = osuCrypto::toBlock(choices[offset + i]);
+        receiver.encode(next_ot + offset + i, &input, &pads[i], sizeof(osuCrypto::block));
+      }
+      receiver.sendCorrection(channel, batch);
+
+      buffer.resize(batch * nchoices * msg_bytes);
+      channel.recv(buffer.data(), buffer.size());
+      for (auto i = 0ull; i < batch; ++i) {
+        uint64_t masked = 0;
+        std::memcpy(&masked, buffer.data() + (i * nchoices + choices[offset + i]) * msg_bytes,
+                    msg_bytes);
+        const auto pad = reinterpret_cast<const uint64_t *>(&pads[i])[0];
+        on_message(offset + i, (masked ^ pad) & msg_mask);
+      }
+    }
+    next_ot += n;
+  }
+
+  // XOR shares of f(server chunk, client chunk) for the nchunks 4-bit chunks of every value
+  template <typename F>
+  std::vector<uint8_t> EvaluateOnChunks(const std::vector<uint64_t> &values, std::size_t nchunks,
+                                        F f) {
+    const auto n = values.size() * nchunks;
+    const auto chunk = [&](std::size_t i) {
+      return static_cast<uint8_t>((values[i / nchunks] >> (chunk_bits * (i % nchunks))) &
+                                  (nchoices - 1));
+    };
+
+    std::vector<uint8_t> shares(n);
+    if (role == SERVER) {
+      for (auto &share : shares) {
+        share = prng->get<uint8_t>() & (nchoices - 1);
+      }
+      SendChosen(n, 1, [&](std::size_t i, uint8_t v) { return shares[i] ^ f(chunk(i), v); });
+    } else {
+      std::vector<uint8_t> choices(n);
+      for (auto i = 0ull; i < n; ++i) {
+        choices[i] = chunk(i);
+      }
+      ReceiveChosen(choices, 1, [&](std::size_t i, uint64_t m) { shares[i] = m; });
+    }
+    return shares;
+  }
+
+  // Shares of f(x) for every group of 4 / entry_bits consecutive entries of the XOR shares, where
+  // x are the concatenated entries and missing entries of the last group are set to padding.
+  // The output shares are XOR shares for uint8_t and additive shares mod 2^64 for uint64_t.
+  template <typename T, typename F>
+  std::vector<T> EvaluateOnGroups(const std::vector<uint8_t> &shares, std::size_t width,
+                                  std::size_t entry_bits, uint8_t padding, F f) {
+    const auto group_size = chunk_bits / entry_bits;
+    const auto ngroups = ceil_divide(width, group_size);
+    const auto ninstances = shares.size() / width;
+    const auto n = ninstances * ngroups;
+    const bool arithmetic = std::is_same<T, uint64_t>::value;
+
+    // the server's shares of the padding entries are the padding, the client's are 0
+    const auto group = [&](std::size_t i) {
+      const auto instance = i / ngroups, first = (i % ngroups) * group_size;
+      uint8_t x = 0;
+      for (auto k = 0ull; k < group_size; ++k) {
+        const uint8_t entry = first + k < width ? shares[instance * width + first + k]
+                                                 : (role == SERVER ? padding : 0);
+        x |= (entry & ((1 << entry_bits) - 1)) << (k * entry_bits);
+      }
+      return x;
+    };
+
+    std::vector<T> outputs(n);
+    if (role == SERVER) {
+      for (auto &output : outputs) {
+        output = prng->get<T>() & (arithmetic ? ~T(0) : T(nchoices - 1));
+      }
+      SendChosen(n, sizeof(T), [&](std::size_t i, uint8_t v) -> uint64_t {
+        const T y = f(group(i) ^ v);
+        return arithmetic ? T(y + outputs[i]) : T(y ^ outputs[i]);
+      });
+      if (arithmetic) {
+        for (auto &output : outputs) {
+          output = T(0) - output;
+        }
+      }
+    } else {
+      std::vector<uint8_t> choices(n);
+      for (auto i = 0ull; i < n; ++i) {
+        choices[i] = group(i);
+      }
+      ReceiveChosen(choices, sizeof(T), [&](std::size_t i, uint64_t m) { outputs[i] = m; });
+    }
+    return outputs;
+  }
+
+  // XOR shares of [server value == client value] or, if arithmetic, shares mod 2^64 of the sum
+  template <typename T>
+  std::vector<T> Equality(const std::vector<uint64_t> &values, std::size_t bitlen) {
+    const bool arithmetic = std::is_same<T, uint64_t>::value;
+    auto width = ceil_divide(bitlen, chunk_bits);
+    auto shares = EvaluateOnChunks(values, width, EqualChunks);
+    while (width > 1 && !(arithmetic && width <= chunk_bits)) {
+      shares = EvaluateOnGroups<uint8_t>(shares, width, 1, 1, AndOfFour);
+      width = ceil_divide(width, chunk_bits);
+    }
+    if (arithmetic) {
+      return EvaluateOnGroups<T>(shares, width, 1, 1, AndOfFour);
+    }
+    return std::vector<T>(shares.begin(), shares.end());
+  }
+
+  // XOR shares of [client value > server value] for bitlen-bit values
+  std::vector<uint8_t> GreaterThan(const std::vector<uint64_t> &values, std::size_t bitlen) {
+    auto width = ceil_divide(bitlen, chunk_bits);
+    auto shares = EvaluateOnChunks(values, width, CompareChunks);
+    while (width > 1) {
+      shares = EvaluateOnGroups<uint8_t>(shares, width, 2, eq_bit, CombineComparisons);
+      width = ceil_divide(width, 2);
+    }
+    for (auto &share : shares) {
+      share &= gt_bit;
+    }
+    return shares;
+  }
+
+  // reveals the shares to both parties
+  template <typename T>
+  std::vector<T> Reveal(const std::vector<T> &shares) {
+    std::vector<T> others(shares.size());
+    channel.send(shares.data(), shares.size() * sizeof(T));
+    channel.recv(others.data(), others.size() * sizeof(T));
+    for (auto i = 0ull; i < shares.size(); ++i) {
+      others[i] = std::is_same<T, uint64_t>::value ? T(others[i] + shares[i])
+                                                   : T(others[i] ^ shares[i]);
+    }
+    return others;
+  }
+};
+
+NativeAnalyticsSession::NativeAnalyticsSession(const PsiAnalyticsContext &context)
+    : network_engine_(context.network_engine),
+      state_(std::make_unique<State>()),
+      role_(context.role),
+      address_(context.address),
+      port_(context.port) {
+  state_->role = static_cast<e_role>(context.role);
+}
+
+NativeAnalyticsSession::~NativeAnalyticsSession() { state_->Close(); }
+
+double NativeAnalyticsSession::Prepare() {
+  std::lock_guard<std::mutex> lock(preparation_mutex_);
+  if (prepared_) {
+    return 0;
+  }
+
+  const auto preparation_start_time = MetricsRegistry::Clock::now();
+
+  std::random_device urandom("/dev/urandom");
+  std::uniform_int_distribution<uint64_t> dist;
+  state_->prng =
+      std::make_unique<osuCrypto::PRNG>(osuCrypto::toBlock(dist(urandom), dist(urandom)));
+
+  // the native backend replaces ABY and thus uses its port
+  {
+    std::lock_guard<std::mutex> connection_lock(connection_mutex_);
+    if (aborted_) {
+      throw std::runtime_error("The native analytics session was aborted");
+    }
+    const std::string name = "native";
+    if (!network_engine_) {
+      state_->ios = std::make_unique<osuCrypto::IOService>();
+    }
+    auto &ios = network_engine_ ? network_engine_->GetIOService() : *state_->ios;
+    state_->session = std::make_unique<osuCrypto::Session>(
+        ios, address_, port_ + aby_port_offset,
+        role_ == SERVER ? osuCrypto::SessionMode::Server : osuCrypto::SessionMode::Client, name);
+    state_->channel = state_->session->addChannel(name, name);
+  }
+
+  // the server is the OT sender
+  osuCrypto::DefaultBaseOT base_ots;
+  if (role_ == SERVER) {
+    state_->sender.configure(false, 40, symsecbits);
+    osuCrypto::BitVector choices(state_->sender.getBaseOTCount());
+    std::vector<osuCrypto::block> base_recv(state_->sender.getBaseOTCount());
+    choices.randomize(*state_->prng);
+    base_ots.receive(choices, base_recv, *state_->prng, state_->channel, 1);
+    state_->sender.setBaseOts(base_recv, choices);
+  } else {
+    state_->receiver.configure(false, 40, symsecbits);
+    std::vector<std::array<osuCrypto::block, 2>> base_send(state_->receiver.getBaseOTCount());
+    base_ots.send(base_send, *state_->prng, state_->channel, 1);
+    state_->receiver.setBaseOts(base_send);
+  }
+  base_ots_communication_ = ChannelCommunication(state_->channel);
+  prepared_ = true;
+
+  const auto preparation_end_time = MetricsRegistry::Clock::now();
+  const duration_millis preparation_duration = preparation_end_time - preparation_start_time;
+  base_ots_duration_ = preparation_duration.count();
+  return preparation_duration.count();
+}
+
+void NativeAnalyticsSession::Abort() {
+  {
+    // the pending operations of a concurrent Prepare throw
+    std::lock_guard<std::mutex> connection_lock(connection_mutex_);
+    aborted_ = true;
+    if (state_->session) {
+      state_->channel.cancel();
+    }
+  }
+  std::lock_guard<std::mutex> lock(preparation_mutex_);
+  state_->Close();
+  prepared_ = false;
+}
+
+uint64_t NativeAnalyticsSession::Execute(std::vector<uint64_t> &bins, PsiAnalyticsContext &context,
+                                         std::vector<uint64_t> & /* payload_bins */,
+                                         std::vector<uint8_t> *match_bits) {
+  if (context.role != role_ || context.address != address_ || context.port != port_) {
+    throw std::runtime_error("The native analytics session was set up for another connection");
+  }
+  if (context.analytics_type == PsiAnalyticsContext::PAYLOAD_SUM ||
+      context.analytics_type == PsiAnalyticsContext::GROUPED_SUM) {
+    throw std::runtime_error("The native backend does not support payloads");
+  }
+  if (context.analytics_type == PsiAnalyticsContext::MATCH_SHARES && !match_bits) {
+    throw std::runtime_error("No buffer for the match shares was given");
+  }
+
+  Prepare();
+  // the base OTs are reused after the first query
+  context.timings.base_ots_aby = nqueries_ == 0 ? base_ots_duration_ : 0;
+  context.communication.base_ots_aby =
+      nqueries_ == 0 ? base_ots_communication_ : PsiAnalyticsContext::Communication();
+  if (nqueries_ == 0) {
+    context.metrics.Add("analytics/preparation/base_ots", base_ots_duration_);
+  }
+
+  auto execution_timer = context.metrics.Time("analytics/execution");
+  const auto setup_start_time = MetricsRegistry::Clock::now();
+  const auto setup_start_communication = ChannelCommunication(state_->channel);
+
+  const auto nbins = bins.size();
+  const bool count = context.analytics_type != PsiAnalyticsContext::NONE &&
+                     context.analytics_type != PsiAnalyticsContext::MATCH_SHARES;
+  const bool compare = context.analytics_type == PsiAnalyticsContext::THRESHOLD ||
+                       context.analytics_type == PsiAnalyticsContext::SUM_IF_GT_THRESHOLD;
+
+  // the sum is at most nbins < 2^sum_bitlen, thresholds >= nbins are never exceeded
+  const auto sum_bitlen =
+      std::max<std::size_t>(static_cast<std::size_t>(std::ceil(std::log2(nbins + 1))), 1);
+  const auto thresholds =
+      context.thresholds.empty() ? std::vector<uint64_t>{context.threshold} : context.thresholds;
+  std::vector<std::size_t> compared_thresholds;
+  if (compare) {
+    for (auto i = 0ull; i < thresholds.size(); ++i) {
+      if (thresholds[i] < nbins) {
+        compared_thresholds.push_back(i);
+      }
+    }
+  }
+
+  const auto nchunks = ceil_divide(context.maxbitlen, chunk_bits);
+  const auto nots = nbins * EqualityOtsPerValue(nchunks, count) +
+                    compared_thresholds.size() *
+                        ComparisonOtsPerValue(ceil_divide(sum_bitlen, chunk_bits));
+  state_->next_ot = 0;
+  if (role_ == SERVER) {
+    state_->sender.init(nots, *state_->prng, state_->channel);
+  } else {
+    state_->receiver.init(nots, *state_->prng, state_->channel);
+  }
+
+  const auto online_start_time = MetricsRegistry::Clock::now();
+  const auto online_start_communication = ChannelCommunication(state_->channel);
+
+  context.outputs.clear();
+  if (!count) {
+    auto shares = state_->Equality<uint8_t>(bins, context.maxbitlen);
+    if (match_bits && context.analytics_type == PsiAnalyticsContext::MATCH_SHARES) {
+      match_bits->assign(ceil_divide(nbins, 8), 0);
+      for (auto i = 0ull; i < nbins; ++i) {
+        match_bits->at(i / 8) |= static_cast<uint8_t>((shares[i] & 1) << (i % 8));
+      }
+    }
+  } else {
+    // each bin contributes an arithmetic share of its equality bit
+    uint64_t sum_share = 0;
+    for (auto share : state_->Equality<uint64_t>(bins, context.maxbitlen)) {
+      sum_share += share;
+    }
+
+    if (context.analytics_type == PsiAnalyticsContext::SUM) {
+      context.outputs.push_back(state_->Reveal(std::vector<uint64_t>{sum_share}).front());
+    } else {
+      // sum > T iff the MSB of d = sum - T - 1 in (sum_bitlen + 1)-bit two's complement is 0.
+      // The MSB is the XOR of the MSBs of the shares of d and the carry of their lower bits,
+      // i.e., [client's lower bits > 2^sum_bitlen - 1 - server's lower bits].
+      const uint64_t lower_mask = (1ull << sum_bitlen) - 1;
+      std::vector<uint64_t> lower_bits;
+      std::vector<uint8_t> msbs;
+      for (auto i : compared_thresholds) {
+        const uint64_t d_share = role_ == SERVER ? sum_share - thresholds[i] - 1 : sum_share;
+        msbs.push_back((d_share >> sum_bitlen) & 1);
+        lower_bits.push_back(role_ == SERVER ? lower_mask - (d_share & lower_mask)
+                                             : d_share & lower_mask);
+      }
+
+      auto gt_shares = state_->GreaterThan(lower_bits, sum_bitlen);
+      for (auto i = 0ull; i < gt_shares.size(); ++i) {
+        gt_shares[i] ^= msbs[i] ^ (role_ == SERVER ? 1 : 0);
+      }
+      const auto gts = state_->Reveal(gt_shares);
+
+      std::vector<uint64_t> results(thresholds.size(), 0);
+      for (auto i = 0ull; i < compared_thresholds.size(); ++i) {
+        results[compared_thresholds[i]] = gts[i];
+      }
+
+      // the sum is only revealed if it is part of the output
+      const bool sum_if_gt = context.analytics_type == PsiAnalyticsContext::SUM_IF_GT_THRESHOLD;
+      const bool sum_is_output =
+          context.output_sum || (sum_if_gt && std::find(gts.begin(), gts.end(), 1) != gts.end());
+      uint64_t sum = 0;
+      if (sum_is_output) {
+        sum = state_->Reveal(std::vector<uint64_t>{sum_share}).front();
+      }
+      if (sum_if_gt) {
+        for (auto &result : results) {
+          result = result ? sum : 0;
+        }
+      }
+
+      context.outputs = results;
+      if (context.output_sum) {
+        context.outputs.push_back(sum);
+      }
+    }
+  }
+
+  const auto online_end_time = MetricsRegistry::Clock::now();
+  execution_timer.Stop();
+  const duration_millis setup_duration = online_start_time - setup_start_time;
+  const duration_millis online_duration = online_end_time - online_start_time;
+  context.timings.circuit_construction = 0;
+  context.timings.aby_setup = setup_duration.count();
+  context.timings.aby_online = online_duration.count();
+  context.timings.aby_total = context.timings.aby_setup + context.timings.aby_online;
+  context.metrics.Add("analytics/setup", context.timings.aby_setup);
+  context.metrics.Add("analytics/online", context.timings.aby_online);
+  if (auto trace = context.metrics.GetTrace()) {
+    trace->Complete("native setup", "analytics", setup_start_time, online_start_time);
+    trace->Complete("native online", "analytics", online_start_time, online_end_time);
+  }
+  context.communication.aby_setup = online_start_communication - setup_start_communication;
+  context.communication.aby_online =
+      ChannelCommunication(state_->channel) - online_start_communication;
+  ++nqueries_;
+
+  return context.outputs.empty() ? 0 : context.outputs.front();
+}
+
+}
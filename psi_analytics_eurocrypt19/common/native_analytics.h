@@ -0,0 +1,85 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "psi_analytics_context.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ENCRYPTO {
+
+// ABY-free post-processing of the OPPRF outputs for NONE, SUM, THRESHOLD, SUM_IF_GT_THRESHOLD
+// and MATCH_SHARES, built directly on the KKRT OT extension of libOTe.
+//
+// All functions are evaluated on XOR-shared bits with 1-out-of-16 OTs: the client's choice is a
+// 4-bit chunk of its OPPRF output or 4 of its shares, the server's messages are the masked
+// function values for all 16 choices. Equality of the bins takes 16 chunk comparisons followed by
+// two layers of 4-input AND gates; the last layer outputs arithmetic shares mod 2^64, which are
+// summed up locally. A threshold is compared with a chunked millionaires' protocol on the MSB of
+// the shared difference. The timings are reported in the aby_* fields of the context.
+//
+// The interface matches AnalyticsCircuitSession, so the base OTs run ahead of or concurrently
+// with the OPPRF and are reused across queries.
+class NativeAnalyticsSession {
+ public:
+  explicit NativeAnalyticsSession(const PsiAnalyticsContext &context);
+  ~NativeAnalyticsSession();
+
+  // connects to the other party and runs the base OTs if this was not done yet;
+  // returns the time spent in this call in milliseconds
+  double Prepare();
+
+  // gives up on the session, e.g., after the OPPRF failed: the channel is cancelled, which ends a
+  // concurrent Prepare, and the connection is closed; later queries throw
+  void Abort();
+
+  // evaluates the analytics function on the OPPRF outputs of the bins, the outputs are stored in
+  // context.outputs; for MATCH_SHARES, the bit-packed shares are written to match_bits instead
+  uint64_t Execute(std::vector<uint64_t> &bins, PsiAnalyticsContext &context,
+                   std::vector<uint64_t> &payload_bins,
+                   std::vector<uint8_t> *match_bits = nullptr);
+
+  std::size_t GetNumOfQueries() const { return nqueries_; }
+
+ private:
+  struct State;
+
+  std::shared_ptr<AsyncNetworkEngine> network_engine_;  //< whose IOService libOTe uses, if set
+  std::unique_ptr<State> state_;
+  uint32_t role_;
+  std::string address_;
+  uint16_t port_;
+  std::size_t nqueries_ = 0;
+
+  std::mutex preparation_mutex_;
+  bool prepared_ = false;
+  std::mutex connection_mutex_;  //< guards the creation of the channel against Abort
+  bool aborted_ = false;
+  double base_ots_duration_ = 0;
+  PsiAnalyticsContext::Communication base_ots_communication_;
+};
+
+}
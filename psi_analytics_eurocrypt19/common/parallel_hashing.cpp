@@ -0,0 +1,365 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "parallel_hashing.h"
+#include "helpers.h"
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace ENCRYPTO {
+
+namespace {
+
+uint64_t Mix(uint64_t element) {
+  element ^= element >> 30;
+  element *= 0xbf58476d1ce4e5b9ull;
+  element ^= element >> 27;
+  element *= 0x94d049bb133111ebull;
+  return element ^ (element >> 31);
+}
+
+// maps the 32-bit prefix of a hash to [0, n) with a multiplication instead of a division
+std::size_t ScaledPrefix(uint64_t hash, std::size_t n) {
+  return static_cast<std::size_t>(((hash >> 32) * n) >> 32);
+}
+
+// the seed of hash function function_i of the tables, which differs from the seeds of the
+// buckets and the shards
+uint64_t AddressSeed(std::size_t function_i) { return Mix(0xd6e8feb86659fd93ull + function_i); }
+
+#ifdef __AVX2__
+// the lower 64 bits of the products of the lanes with a constant; AVX2 only multiplies 32-bit
+// halves, so the product is put together from three of them
+__m256i MulLo64(__m256i x, uint64_t constant) {
+  const auto c = _mm256_set1_epi64x(static_cast<long long>(constant));
+  const auto c_hi = _mm256_set1_epi64x(static_cast<long long>(constant >> 32));
+  const auto lo = _mm256_mul_epu32(x, c);
+  const auto cross =
+      _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), c), _mm256_mul_epu32(x, c_hi));
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+// ScaledPrefix(Mix(x)) of four lanes, with the result in the lower half of every lane
+__m256i ScaledPrefixOfMix(__m256i x, __m256i scale) {
+  x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 30));
+  x = MulLo64(x, 0xbf58476d1ce4e5b9ull);
+  x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 27));
+  x = MulLo64(x, 0x94d049bb133111ebull);
+  x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 31));
+  return _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), scale), 32);
+}
+#endif
+
+// throws unless the tables have one of cuckoo_configurations and 1 to 2^32 bins; the cuckoo table
+// of nelements elements also needs at least epsilon bins per element, up to the rounding of the
+// bins and of a float epsilon, unless the client has stash bins for the elements that find no bin
+void CheckTable(const PsiAnalyticsContext &context, std::size_t nelements, bool cuckoo) {
+  if (context.nbins == 0 || context.nbins > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("The tables need 1 to 2^32 bins");
+  }
+  const auto configuration =
+      std::find_if(std::begin(cuckoo_configurations), std::end(cuckoo_configurations),
+                   [&context](const CuckooConfiguration &c) { return c.nfuns == context.nfuns; });
+  if (configuration == std::end(cuckoo_configurations)) {
+    throw std::runtime_error("The tables support 2 or 3 hash functions, not " +
+                             std::to_string(context.nfuns));
+  }
+  if (cuckoo && context.nstashbins == 0 &&
+      context.nbins < std::floor(configuration->epsilon * nelements * (1 - 1e-6))) {
+    std::ostringstream message;
+    message << "The cuckoo table with " << context.nfuns << " hash functions needs at least "
+            << configuration->epsilon << " bins per element or stash bins";
+    throw std::runtime_error(message.str());
+  }
+}
+
+constexpr std::size_t kPrefetchDistance = 16;
+
+// the addresses of all elements, computed by the batched kernel on contiguous chunks of the
+// input in parallel
+std::vector<uint32_t> ParallelBinAddresses(const std::vector<uint64_t> &elements,
+                                           const PsiAnalyticsContext &context) {
+  const auto nthreads = std::max<std::size_t>(
+      std::min<std::size_t>(context.nthreads, elements.size()), 1);
+  const auto chunk_size = (elements.size() + nthreads - 1) / nthreads;
+  std::vector<uint32_t> addresses(elements.size() * context.nfuns);
+  ParallelFor(nthreads, nthreads, [&](std::size_t t) {
+    const auto begin = std::min(elements.size(), t * chunk_size);
+    const auto end = std::min(elements.size(), (t + 1) * chunk_size);
+    BinAddressesOf(elements.data() + begin, end - begin, context.nfuns, context.nbins,
+                   addresses.data() + begin * context.nfuns);
+  });
+  return addresses;
+}
+
+constexpr uint32_t kNoElement = std::numeric_limits<uint32_t>::max();
+
+// evictions of the random walk until an element goes to the stash
+constexpr std::size_t kMaxEvictions = 512;
+
+// Cuckoo hashing by random walk over the precomputed addresses of n elements: an element goes to
+// the first of its bins that is empty, otherwise it evicts the element of a random one of its bins,
+// which is inserted the same way. The walk is driven by a counter-based generator, so the table is
+// a function of the elements and their order. slots holds the index of the element of each bin;
+// the indices of the stashed elements are returned.
+std::vector<uint32_t> CuckooInsert(const uint32_t *addresses, std::size_t n, std::size_t nfuns,
+                                   std::vector<uint32_t> &slots) {
+  std::vector<uint32_t> stash;
+  uint64_t walk = 0;
+  const auto place_in_empty_bin = [&](uint32_t element) {
+    for (auto j = 0ull; j < nfuns; ++j) {
+      auto &slot = slots[addresses[element * nfuns + j]];
+      if (slot == kNoElement) {
+        slot = element;
+        return true;
+      }
+    }
+    return false;
+  };
+
+  for (auto i = 0ull; i < n; ++i) {
+    // the bins of an element are random, so fetch the ones of a later element early
+    if (i + kPrefetchDistance < n) {
+      for (auto j = 0ull; j < nfuns; ++j) {
+        __builtin_prefetch(slots.data() + addresses[(i + kPrefetchDistance) * nfuns + j], 1);
+      }
+    }
+    auto element = static_cast<uint32_t>(i);
+    if (place_in_empty_bin(element)) {
+      continue;
+    }
+    std::size_t previous_bin = slots.size();
+    bool placed = false;
+    for (auto eviction = 0ull; eviction < kMaxEvictions && !placed; ++eviction) {
+      // never evict the element that was just placed
+      auto j = ScaledPrefix(Mix(++walk), nfuns);
+      if (nfuns > 1 && addresses[element * nfuns + j] == previous_bin) {
+        j = (j + 1) % nfuns;
+      }
+      previous_bin = addresses[element * nfuns + j];
+      std::swap(element, slots[previous_bin]);
+      placed = place_in_empty_bin(element);
+    }
+    if (!placed) {
+      stash.push_back(element);
+    }
+  }
+  return stash;
+}
+
+// an element of the simple table and one of its distinct bins
+struct BinEntry {
+  uint32_t element;
+  uint32_t bin;
+};
+
+// elements whose addresses the threads of the simple table compute at once
+constexpr std::size_t kAddressBlock = 1024;
+
+// The distinct bins of every element in CSR layout, ordered by bin and, within a bin, by the
+// position of the element in elements. Every thread first computes the addresses of its chunk of
+// the input and sorts the entries by the thread that owns their bin range, counting them before
+// it stores them. Then every thread counts and fills the bins of its own range from the entries of
+// the chunks in input order, so it writes without locks and the table is the sequential one.
+BinnedElements SimpleInsert(const std::vector<uint64_t> &elements, std::size_t nfuns,
+                            std::size_t nbins, std::size_t nthreads) {
+  nthreads = std::max<std::size_t>(std::min<std::size_t>(nthreads, nbins), 1);
+  const auto owner_of = [&](uint32_t bin) {
+    return static_cast<std::size_t>(static_cast<uint64_t>(bin) * nthreads / nbins);
+  };
+  const auto chunk_size = (elements.size() + nthreads - 1) / nthreads;
+
+  // entries[chunk][owner] holds the entries of a chunk of the input in the bins of an owner
+  std::vector<std::vector<std::vector<BinEntry>>> entries(nthreads);
+  ParallelFor(nthreads, nthreads, [&](std::size_t chunk) {
+    const auto begin = std::min(elements.size(), chunk * chunk_size);
+    const auto end = std::min(elements.size(), (chunk + 1) * chunk_size);
+    std::vector<uint32_t> addresses(kAddressBlock * nfuns);
+    // calls f(entry) for every distinct bin of every element of the chunk
+    const auto for_each_entry = [&](const auto &f) {
+      for (auto block = begin; block < end; block += kAddressBlock) {
+        const auto n = std::min(kAddressBlock, end - block);
+        BinAddressesOf(elements.data() + block, n, nfuns, nbins, addresses.data());
+        for (auto i = 0ull; i < n; ++i) {
+          const auto element_addresses = addresses.data() + i * nfuns;
+          for (auto j = 0ull; j < nfuns; ++j) {
+            // an element is put only once into a bin that several of its functions map it to
+            if (std::find(element_addresses, element_addresses + j, element_addresses[j]) ==
+                element_addresses + j) {
+              f(BinEntry{static_cast<uint32_t>(block + i), element_addresses[j]});
+            }
+          }
+        }
+      }
+    };
+
+    // the addresses are computed twice, so that the entries are allocated at their exact size
+    std::vector<std::size_t> counts(nthreads, 0);
+    for_each_entry([&](const BinEntry &entry) { ++counts[owner_of(entry.bin)]; });
+    entries[chunk].resize(nthreads);
+    for (auto owner = 0ull; owner < nthreads; ++owner) {
+      entries[chunk][owner].reserve(counts[owner]);
+    }
+    for_each_entry(
+        [&](const BinEntry &entry) { entries[chunk][owner_of(entry.bin)].push_back(entry); });
+  });
+
+  BinnedElements table;
+  table.offsets.assign(nbins + 1, 0);
+  ParallelFor(nthreads, nthreads, [&](std::size_t t) {
+    for (const auto &chunk_entries : entries) {
+      for (const auto &entry : chunk_entries[t]) {
+        ++table.offsets[entry.bin + 1];
+      }
+    }
+  });
+  for (auto bin = 0ull; bin < nbins; ++bin) {
+    table.offsets[bin + 1] += table.offsets[bin];
+  }
+
+  // the offsets are used as the write positions of the bins and shifted back afterwards
+  table.elements.resize(table.offsets.back());
+  ParallelFor(nthreads, nthreads, [&](std::size_t t) {
+    for (auto &chunk_entries : entries) {
+      auto &owned = chunk_entries[t];
+      for (auto k = 0ull; k < owned.size(); ++k) {
+        // the bins are random, so fetch the write position of a later entry early
+        if (k + kPrefetchDistance < owned.size()) {
+          __builtin_prefetch(
+              table.elements.data() + table.offsets[owned[k + kPrefetchDistance].bin], 1);
+        }
+        table.elements[table.offsets[owned[k].bin]++] = elements[owned[k].element];
+      }
+      std::vector<BinEntry>().swap(owned);
+    }
+  });
+  for (auto bin = nbins; bin > 0; --bin) {
+    table.offsets[bin] = table.offsets[bin - 1];
+  }
+  table.offsets[0] = 0;
+  return table;
+}
+
+}  // namespace
+
+std::size_t BucketOf(uint64_t element, std::size_t nbuckets) {
+  return ScaledPrefix(Mix(element), nbuckets);
+}
+
+std::size_t BinAddressOf(uint64_t element, std::size_t function_i, std::size_t nbins) {
+  return ScaledPrefix(Mix(element ^ AddressSeed(function_i)), nbins);
+}
+
+void BinAddressesOf(const uint64_t *elements, std::size_t n, std::size_t nfuns,
+                    std::size_t nbins, uint32_t *addresses) {
+  std::vector<uint64_t> seeds(nfuns);
+  for (auto j = 0ull; j < nfuns; ++j) {
+    seeds[j] = AddressSeed(j);
+  }
+
+  std::size_t i = 0;
+#ifdef __AVX2__
+  const auto scale = _mm256_set1_epi64x(static_cast<long long>(nbins));
+  for (; i + 4 <= n; i += 4) {
+    const auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(elements + i));
+    for (auto j = 0ull; j < nfuns; ++j) {
+      const auto seed = _mm256_set1_epi64x(static_cast<long long>(seeds[j]));
+      alignas(32) uint64_t lanes[4];
+      _mm256_store_si256(reinterpret_cast<__m256i *>(lanes),
+                         ScaledPrefixOfMix(_mm256_xor_si256(x, seed), scale));
+      for (auto lane = 0u; lane < 4; ++lane) {
+        addresses[(i + lane) * nfuns + j] = static_cast<uint32_t>(lanes[lane]);
+      }
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    for (auto j = 0ull; j < nfuns; ++j) {
+      addresses[i * nfuns + j] =
+          static_cast<uint32_t>(ScaledPrefix(Mix(elements[i] ^ seeds[j]), nbins));
+    }
+  }
+}
+
+std::size_t ShardOf(uint64_t element, std::size_t nshards) {
+  // a hash with another seed than BucketOf
+  return ScaledPrefix(Mix(element ^ 0x9e3779b97f4a7c15ull), nshards);
+}
+
+std::size_t ShardCapacity(std::size_t neles, std::size_t nshards,
+                          std::size_t statistical_security) {
+  if (nshards <= 1) {
+    return neles;
+  }
+  // Chernoff: Pr[X >= (1 + d) * mu] <= exp(-d^2 * mu / (2 + d)) for the size X of a shard with
+  // mean mu; d is the solution of d^2 * mu = t * (2 + d) for a union bound over all shards
+  const double mu = static_cast<double>(neles) / nshards;
+  const double t = std::log(nshards) + statistical_security * std::log(2.0);
+  const double d = (t + std::sqrt(t * t + 8 * t * mu)) / (2 * mu);
+  return std::min<std::size_t>(static_cast<std::size_t>(std::ceil((1 + d) * mu)), neles);
+}
+
+std::vector<uint64_t> ParallelCuckooHashing(const std::vector<uint64_t> &elements,
+                                            const PsiAnalyticsContext &context,
+                                            std::vector<uint64_t> *stash) {
+  CheckTable(context, elements.size(), true);
+  if (elements.size() >= kNoElement) {
+    throw std::runtime_error("Cuckoo hashing supports less than 2^32 - 1 elements");
+  }
+  const auto addresses = ParallelBinAddresses(elements, context);
+
+  // the insertion itself is sequential, so that the table does not depend on the threads
+  std::vector<uint32_t> slots(context.nbins, kNoElement);
+  stash->clear();
+  for (auto element : CuckooInsert(addresses.data(), elements.size(), context.nfuns, slots)) {
+    stash->push_back(elements[element]);
+  }
+
+  const auto nthreads = std::max<std::size_t>(context.nthreads, 1);
+  std::vector<uint64_t> table(context.nbins);
+  ParallelFor(nthreads, nthreads, [&](std::size_t t) {
+    const auto end = (t + 1) * context.nbins / nthreads;
+    for (auto bin = t * context.nbins / nthreads; bin < end; ++bin) {
+      table[bin] = slots[bin] == kNoElement ? cuckoo_empty_bin : elements[slots[bin]];
+    }
+  });
+  return table;
+}
+
+BinnedElements ParallelSimpleHashing(const std::vector<uint64_t> &elements,
+                                     const PsiAnalyticsContext &context) {
+  CheckTable(context, elements.size(), false);
+  if (elements.size() > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("Simple hashing supports at most 2^32 - 1 elements");
+  }
+  return SimpleInsert(elements, context.nfuns, context.nbins, context.nthreads);
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "binned_elements.h"
+#include "psi_analytics_context.h"
+
+#include <cinttypes>
+#include <vector>
+
+namespace ENCRYPTO {
+
+// Hashing of the elements with context.nthreads threads into one table of context.nbins bins.
+// The threads of the simple table compute the addresses of chunks of the input and fill disjoint
+// ranges of bins. The cuckoo insertion is NOT parallel: only the addresses and the final table
+// are computed by the threads, while one thread inserts the elements one after the other, since
+// the eviction chains of a parallel insertion would make the table depend on the threads. Hence
+// both tables are exactly the sequential ones for every number of threads, and the failure
+// probability of the cuckoo table is the one of its epsilon and nfuns.
+
+// marks the empty bins of the cuckoo table; the elements are mapped to 61 bits before they are
+// hashed, see PreprocessElements, so no element is equal to it
+constexpr uint64_t cuckoo_empty_bin = ~0ull;
+
+// the hash function counts of the tables and the smallest table size multiplier of the cuckoo
+// table for them, from Pinkas et al., "Efficient Circuit-based PSI via Cuckoo Hashing", Eurocrypt
+// 2018. The stash rate of BinAddressOf at them is checked by the pow_2_12_cuckoo_stash_rate test:
+// with 3 functions, none of 1000 runs with 2^12 elements stashes an element; with 2 functions,
+// about one in 1000 runs does, so only the former is stashless and the latter needs stash bins
+struct CuckooConfiguration {
+  uint64_t nfuns;
+  double epsilon;
+  bool stashless;
+};
+constexpr CuckooConfiguration cuckoo_configurations[] = {{2, 2.4, false}, {3, 1.27, true}};
+
+// returns the cuckoo table as a raw vector with cuckoo_empty_bin in the empty bins; the elements
+// that found no bin are stored in stash
+std::vector<uint64_t> ParallelCuckooHashing(const std::vector<uint64_t> &elements,
+                                            const PsiAnalyticsContext &context,
+                                            std::vector<uint64_t> *stash);
+
+// returns the simple table with all elements of every bin in one contiguous array; an element
+// is stored once per distinct bin of its hash functions, in the order of the input
+BinnedElements ParallelSimpleHashing(const std::vector<uint64_t> &elements,
+                                     const PsiAnalyticsContext &context);
+
+// bin of an element under hash function function_i in a table of nbins <= 2^32 bins: the 32-bit
+// prefix of the splitmix64 finalizer of the element XOR a seed per function, scaled to [0, nbins)
+std::size_t BinAddressOf(uint64_t element, std::size_t function_i, std::size_t nbins);
+
+// BinAddressOf of n elements for all nfuns functions at once, four elements per AVX2 instruction
+// if available; addresses[i * nfuns + j] is the bin of element i under function j
+void BinAddressesOf(const uint64_t *elements, std::size_t n, std::size_t nfuns,
+                    std::size_t nbins, uint32_t *addresses);
+
+// index of the bucket of an element among nbuckets, e.g., of the stash bins: the 32-bit prefix
+// of the splitmix64 finalizer, which is independent of the hash functions of the tables, scaled
+// to [0, nbuckets)
+std::size_t BucketOf(uint64_t element, std::size_t nbuckets);
+
+// Shards split the whole element space for runs with PsiAnalyticsContext::nshards > 1. The shard
+// of an element is given by a hash prefix, which is independent of its bins.
+std::size_t ShardOf(uint64_t element, std::size_t nshards);
+
+// number of elements that every shard of a set of neles elements is sized for; a shard exceeds it
+// with probability at most 2^-statistical_security
+std::size_t ShardCapacity(std::size_t neles, std::size_t nshards,
+                          std::size_t statistical_security = 40);
+
+}
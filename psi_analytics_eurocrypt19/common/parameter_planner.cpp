@@ -0,0 +1,274 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "parameter_planner.h"
+#include "parallel_hashing.h"
+#include "psi_analytics.h"
+
+#include "ENCRYPTO_utils/typedefs.h"
+#include "network/async_network_engine.h"
+#include "ots/ots.h"
+#include "polynomials/Poly.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+namespace ENCRYPTO {
+
+namespace {
+
+// the equality circuit has maxbitlen - 1 AND gates per bin, each needs a multiplication triple
+// from OT extension, i.e., about 256 bits of communication, and its depth is logarithmic
+constexpr double circuit_bytes_per_bin = 60 * 32;
+constexpr double circuit_rounds = 10;
+
+constexpr double kkrt_bytes_per_bin = 64;  //< the receiver's correction of one KKRT OPRF
+
+// relative entropy D(a || p) of two Bernoulli distributions
+double RelativeEntropy(double a, double p) {
+  return a * std::log(a / p) + (1 - a) * std::log((1 - a) / (1 - p));
+}
+
+double TransmissionMs(double bytes, const PlannerInput &input) {
+  return bytes * 8 / (input.bandwidth_mbps * 1e3) + input.latency_ms;
+}
+
+// nanoseconds per call of f, repeated until at least 20 ms have passed
+template <typename F>
+double MeasureNs(const F &f) {
+  std::size_t repetitions = 0;
+  const auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double, std::nano> duration(0);
+  do {
+    f();
+    ++repetitions;
+    duration = std::chrono::steady_clock::now() - start;
+  } while (duration.count() < 2e7);
+  return duration.count() / repetitions;
+}
+
+}  // namespace
+
+uint64_t MinPolynomialSize(uint64_t nelements, uint64_t nbins, uint64_t nmegabins,
+                           uint64_t statistical_security) {
+  if (nmegabins <= 1 || nelements == 0) {
+    return std::max<uint64_t>(nelements, 1);
+  }
+  // every element lands in a mega bin with probability p, and
+  // P[load >= k] <= exp(-nelements * D(k / nelements || p)) for k above the mean; the union
+  // bound over all mega bins has to stay below 2^-statistical_security
+  const double p = static_cast<double>(ceil_divide(nbins, nmegabins)) / nbins;
+  const double log_target = -static_cast<double>(statistical_security) * std::log(2.0) -
+                            std::log(static_cast<double>(nmegabins));
+  auto fails = [&](uint64_t k) {
+    return k < nelements &&
+           -static_cast<double>(nelements) *
+                   RelativeEntropy(static_cast<double>(k) / nelements, p) >
+               log_target;
+  };
+
+  uint64_t low = static_cast<uint64_t>(std::ceil(nelements * p)), high = nelements;
+  while (low < high) {
+    const auto mid = low + (high - low) / 2;
+    if (fails(mid)) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+PsiParameters PlanParameters(const PlannerInput &input, const CostModel &model) {
+  if (input.client_neles == 0 || input.server_neles == 0 || input.bandwidth_mbps <= 0) {
+    throw std::runtime_error("The planner needs elements on both sides and a positive bandwidth");
+  }
+
+  PsiParameters best{};
+  best.predicted_ms = std::numeric_limits<double>::infinity();
+  for (const auto &configuration : cuckoo_configurations) {
+    // the planned parameters have no stash bins
+    if (!configuration.stashless) {
+      continue;
+    }
+    const auto nfuns = configuration.nfuns;
+    const auto epsilon = configuration.epsilon;
+    const auto nbins = std::max<uint64_t>(static_cast<uint64_t>(input.client_neles * epsilon), 1);
+    const auto npoints = nfuns * input.server_neles;
+
+    const double hashing_ms = model.hashing_ns_per_element * nfuns *
+                              std::max(input.client_neles, input.server_neles) / 1e6;
+    const double oprf_ms = std::max(model.oprf_ns_per_bin * nbins,
+                                    model.oprf_ns_per_element * npoints) / 1e6 +
+                           TransmissionMs(kkrt_bytes_per_bin * nbins, input);
+    const double circuit_ms = TransmissionMs(circuit_bytes_per_bin * nbins, input) +
+                              circuit_rounds * input.latency_ms;
+
+    // more mega bins mean smaller polynomials, i.e., faster interpolation and evaluation, but a
+    // larger relative overhead of the padding to the maximum load
+    for (uint64_t target = 1; target <= nbins;
+         target = static_cast<uint64_t>(std::ceil(target * 1.02))) {
+      // the last mega bins would stay empty otherwise
+      const auto nmegabins = ceil_divide(nbins, ceil_divide(nbins, target));
+      const auto polynomialsize =
+          MinPolynomialSize(npoints, nbins, nmegabins, input.statistical_security);
+      const double k = static_cast<double>(polynomialsize);
+      const double interpolation_ms = nmegabins *
+                                      (model.interpolation_ns_per_point_squared * k * k +
+                                       model.interpolation_ns_per_point * k) / 1e6;
+      const double evaluation_ms = model.evaluation_ns_per_coefficient * nbins * k / 1e6;
+      const double transmission_ms = TransmissionMs(8.0 * nmegabins * k, input);
+
+      const double predicted_ms = hashing_ms + oprf_ms + interpolation_ms + transmission_ms +
+                                  evaluation_ms + circuit_ms;
+      if (predicted_ms < best.predicted_ms) {
+        best = {nfuns, epsilon, nbins, nmegabins, polynomialsize, predicted_ms};
+      }
+    }
+  }
+  return best;
+}
+
+void ExchangeParameters(PsiParameters &parameters, const PsiAnalyticsContext &context) {
+  if (context.network_engine) {
+    // the transfer runs as a continuation of the connection on an I/O thread of the engine
+    auto &engine = *context.network_engine;
+    std::promise<bool> exchanged;
+    auto exchanged_future = exchanged.get_future();
+    const auto on_connected = [&](int fd) {
+      if (fd < 0) {
+        exchanged.set_value(false);
+        return;
+      }
+      const auto on_done = [&engine, &exchanged, fd](bool success) {
+        engine.Close(fd);
+        exchanged.set_value(success);
+      };
+      if (context.role == SERVER) {
+        engine.AsyncSend(fd, &parameters, sizeof(parameters), on_done);
+      } else {
+        engine.AsyncReceive(fd, &parameters, sizeof(parameters), on_done);
+      }
+    };
+    if (context.role == SERVER) {
+      engine.AsyncAccept(context.address, context.port, on_connected);
+    } else {
+      on_connected(engine.Connect(context.address, context.port));
+    }
+    if (!exchanged_future.get()) {
+      throw std::runtime_error("The planned parameters could not be exchanged");
+    }
+    return;
+  }
+
+  auto sock =
+      EstablishConnection(context.address, context.port, static_cast<e_role>(context.role));
+  if (context.role == SERVER) {
+    sock->Send(&parameters, sizeof(parameters));
+  } else if (sock->Receive(&parameters, sizeof(parameters)) != sizeof(parameters)) {
+    throw std::runtime_error("The server did not send the planned parameters");
+  }
+  sock->Close();
+}
+
+void ApplyParameters(const PsiParameters &parameters, PsiAnalyticsContext &context) {
+  context.nfuns = parameters.nfuns;
+  context.epsilon = parameters.epsilon;
+  context.nbins = parameters.nbins;
+  context.nmegabins = parameters.nmegabins;
+  context.polynomialsize = parameters.polynomialsize;
+  context.polynomialbytelength = parameters.polynomialsize * sizeof(uint64_t);
+}
+
+CostModel CalibrateCostModel(uint16_t port) {
+  CostModel model;
+  std::mt19937_64 prng(std::random_device{}());
+  auto random_points = [&prng](std::size_t n) {
+    std::vector<ZpMersenneLongElement> points(n);
+    for (auto &point : points) {
+      point.elem = prng() & __61_bit_mask;
+    }
+    return points;
+  };
+
+  // interpolation takes a * k^2 + b * k for k points, solved from two sizes
+  constexpr double k1 = 256, k2 = 1024;
+  double interpolation_ns[2];
+  for (auto i = 0; i < 2; ++i) {
+    const auto k = static_cast<std::size_t>(i == 0 ? k1 : k2);
+    const auto X = random_points(k);
+    auto Y = random_points(k);
+    std::vector<ZpMersenneLongElement> coefficients(k);
+    interpolation_ns[i] = MeasureNs([&]() { Poly::interpolateMersenne(coefficients, X, Y); });
+  }
+  model.interpolation_ns_per_point_squared =
+      std::max((interpolation_ns[1] / k2 - interpolation_ns[0] / k1) / (k2 - k1), 0.0);
+  model.interpolation_ns_per_point = std::max(
+      interpolation_ns[0] / k1 - model.interpolation_ns_per_point_squared * k1, 0.0);
+
+  const auto polynomial = random_points(static_cast<std::size_t>(k2));
+  const auto X = random_points(1);
+  ZpMersenneLongElement Y;
+  model.evaluation_ns_per_coefficient =
+      MeasureNs([&]() { Poly::evalMersenne(Y, polynomial, X.at(0)); }) / k2;
+
+  // the client's cuckoo hashing with three hash functions on a single thread
+  constexpr std::size_t nelements = 1 << 16;
+  std::vector<uint64_t> elements(nelements);
+  std::generate(elements.begin(), elements.end(), [&prng]() { return prng() & __61_bit_mask; });
+  PsiAnalyticsContext client_context{port, CLIENT};
+  client_context.nbins = static_cast<uint64_t>(nelements * 1.27);
+  client_context.nfuns = 3;
+  client_context.nthreads = 1;
+  client_context.address = "127.0.0.1";
+  std::vector<uint64_t> stash;
+  model.hashing_ns_per_element =
+      MeasureNs([&]() { ParallelCuckooHashing(elements, client_context, &stash); }) /
+      (nelements * client_context.nfuns);
+
+  // a local OPRF run, with three elements per bin on the sender's side
+  constexpr std::size_t nots = 1 << 14;
+  BinnedElements sender_bins;
+  for (auto i = 0ull; i < nots; ++i) {
+    const uint64_t bin[] = {prng() & __61_bit_mask, prng() & __61_bit_mask, prng() & __61_bit_mask};
+    sender_bins.AppendBin(std::begin(bin), std::end(bin));
+  }
+  auto server_context = client_context;
+  server_context.role = SERVER;
+  std::thread sender([&]() { ot_sender(sender_bins, server_context); });
+  ot_receiver(std::vector<uint64_t>(elements.begin(), elements.begin() + nots), client_context);
+  sender.join();
+  model.oprf_ns_per_bin = client_context.timings.oprf * 1e6 / nots;
+  model.oprf_ns_per_element = server_context.timings.oprf * 1e6 / (3 * nots);
+
+  return model;
+}
+
+}
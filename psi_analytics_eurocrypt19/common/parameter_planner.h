@@ -0,0 +1,86 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "psi_analytics_context.h"
+
+#include <cinttypes>
+#include <cstddef>
+
+namespace ENCRYPTO {
+
+// Costs of the local operations that the planner trades off against each other, in nanoseconds.
+// The defaults were measured on a 3 GHz desktop machine, CalibrateCostModel() measures them
+// locally. Only the server plans, see ExchangeParameters, so both parties use its parameters.
+struct CostModel {
+  double interpolation_ns_per_point_squared = 7.0;  //< quadratic part of interpolateMersenne
+  double interpolation_ns_per_point = 1200.0;       //< one modular inversion per point
+  double evaluation_ns_per_coefficient = 5.0;
+  double hashing_ns_per_element = 250.0;  //< per element and hash function
+  double oprf_ns_per_bin = 2000.0;        //< receiver side of the KKRT OPRF
+  double oprf_ns_per_element = 400.0;     //< sender side, per element in a bin
+};
+
+// the link between the parties and the targets of the planner
+struct PlannerInput {
+  uint64_t client_neles;
+  uint64_t server_neles;
+  double bandwidth_mbps = 1000.0;
+  double latency_ms = 0.1;
+  uint64_t statistical_security = 40;  //< the failure probability is at most 2^-40
+};
+
+struct PsiParameters {
+  uint64_t nfuns;
+  double epsilon;
+  uint64_t nbins;
+  uint64_t nmegabins;
+  uint64_t polynomialsize;
+  double predicted_ms;  //< predicted runtime of hashing, OPRF, OPPRF and the equality circuit
+};
+
+// Picks the number of hash functions (with the table size that is known to fail with probability
+// below 2^-40 for it), the mega bins and the polynomial size that minimize the predicted runtime.
+// The polynomial size of a number of mega bins is the smallest one that every mega bin fits into
+// except with probability 2^-statistical_security, using a Chernoff bound for its load.
+PsiParameters PlanParameters(const PlannerInput &input, const CostModel &model = CostModel());
+
+// The server sends the parameters that it planned to the client over a connection on context.port,
+// on context.network_engine if set; the client overwrites parameters with them
+void ExchangeParameters(PsiParameters &parameters, const PsiAnalyticsContext &context);
+
+// sets the planned parameters in the context
+void ApplyParameters(const PsiParameters &parameters, PsiAnalyticsContext &context);
+
+// smallest polynomial size such that none of the nmegabins mega bins of a table with nbins bins
+// gets more of the nelements (uniformly hashed) points, except with probability
+// 2^-statistical_security
+uint64_t MinPolynomialSize(uint64_t nelements, uint64_t nbins, uint64_t nmegabins,
+                           uint64_t statistical_security);
+
+// measures the cost model on this machine with microbenchmarks of interpolation, evaluation,
+// hashing and a local OPRF run on the given port (and the libOTe port above it); takes a few
+// seconds
+CostModel CalibrateCostModel(uint16_t port);
+
+}
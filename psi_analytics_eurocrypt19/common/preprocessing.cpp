@@ -0,0 +1,150 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "preprocessing.h"
+#include "constants.h"
+#include "helpers.h"
+
+#include "HashingTables/common/hashing.h"
+
+#include <algorithm>
+#include <array>
+
+namespace ENCRYPTO {
+
+namespace {
+
+constexpr std::size_t kDigitBits = 11, kNumOfBuckets = 1ull << kDigitBits;
+// below this size, the passes over the buckets cost more than they save
+constexpr std::size_t kMinRadixSortSize = 1ull << 12;
+
+// the elements are processed in nthreads contiguous chunks, which keeps the sort stable
+struct Chunks {
+  std::size_t n, nchunks;
+
+  std::size_t Begin(std::size_t chunk) const { return n * chunk / nchunks; }
+  std::size_t End(std::size_t chunk) const { return n * (chunk + 1) / nchunks; }
+};
+
+// keeps the first copy of every element of the sorted input and writes map(element) to the output
+template <typename Map>
+std::vector<uint64_t> UniqueAndMap(const std::vector<uint64_t> &sorted, std::size_t nthreads,
+                                   const Map &map) {
+  const Chunks chunks{sorted.size(), std::max<std::size_t>(nthreads, 1)};
+  const auto is_first_copy = [&sorted](std::size_t i) {
+    return i == 0 || sorted[i] != sorted[i - 1];
+  };
+
+  std::vector<std::size_t> offsets(chunks.nchunks + 1, 0);
+  ParallelFor(chunks.nchunks, chunks.nchunks, [&](std::size_t c) {
+    for (auto i = chunks.Begin(c); i < chunks.End(c); ++i) {
+      offsets[c + 1] += is_first_copy(i);
+    }
+  });
+  for (auto c = 0ull; c < chunks.nchunks; ++c) {
+    offsets[c + 1] += offsets[c];
+  }
+
+  std::vector<uint64_t> unique(offsets.back());
+  ParallelFor(chunks.nchunks, chunks.nchunks, [&](std::size_t c) {
+    auto position = offsets[c];
+    for (auto i = chunks.Begin(c); i < chunks.End(c); ++i) {
+      if (is_first_copy(i)) {
+        unique[position++] = map(sorted[i]);
+      }
+    }
+  });
+  return unique;
+}
+
+}  // namespace
+
+void RadixSort(std::vector<uint64_t> &elements, std::size_t nthreads) {
+  if (elements.size() < kMinRadixSortSize) {
+    std::sort(elements.begin(), elements.end());
+    return;
+  }
+  const Chunks chunks{elements.size(), std::max<std::size_t>(nthreads, 1)};
+
+  // the bits in which any element differs from the first one
+  std::vector<uint64_t> chunk_differences(chunks.nchunks, 0);
+  ParallelFor(chunks.nchunks, chunks.nchunks, [&](std::size_t c) {
+    for (auto i = chunks.Begin(c); i < chunks.End(c); ++i) {
+      chunk_differences[c] |= elements[i] ^ elements.front();
+    }
+  });
+  uint64_t differences = 0;
+  for (auto chunk_difference : chunk_differences) {
+    differences |= chunk_difference;
+  }
+
+  std::vector<uint64_t> buffer(elements.size());
+  std::vector<std::array<std::size_t, kNumOfBuckets>> offsets(chunks.nchunks);
+  for (auto shift = 0u; shift < 64; shift += kDigitBits) {
+    if (((differences >> shift) & (kNumOfBuckets - 1)) == 0) {
+      continue;
+    }
+    const auto digit = [shift](uint64_t element) {
+      return (element >> shift) & (kNumOfBuckets - 1);
+    };
+
+    ParallelFor(chunks.nchunks, chunks.nchunks, [&](std::size_t c) {
+      offsets[c].fill(0);
+      for (auto i = chunks.Begin(c); i < chunks.End(c); ++i) {
+        ++offsets[c][digit(elements[i])];
+      }
+    });
+
+    // the elements of a bucket are ordered by chunk, i.e., by their previous position
+    std::size_t position = 0;
+    for (auto bucket = 0ull; bucket < kNumOfBuckets; ++bucket) {
+      for (auto c = 0ull; c < chunks.nchunks; ++c) {
+        const auto count = offsets[c][bucket];
+        offsets[c][bucket] = position;
+        position += count;
+      }
+    }
+
+    ParallelFor(chunks.nchunks, chunks.nchunks, [&](std::size_t c) {
+      auto &chunk_offsets = offsets[c];
+      for (auto i = chunks.Begin(c); i < chunks.End(c); ++i) {
+        buffer[chunk_offsets[digit(elements[i])]++] = elements[i];
+      }
+    });
+    elements.swap(buffer);
+  }
+}
+
+void SortUnique(std::vector<uint64_t> &elements, std::size_t nthreads) {
+  RadixSort(elements, nthreads);
+  elements = UniqueAndMap(elements, nthreads, [](uint64_t element) { return element; });
+}
+
+std::vector<uint64_t> PreprocessElements(std::vector<uint64_t> elements, std::size_t nthreads) {
+  RadixSort(elements, nthreads);
+  return UniqueAndMap(elements, nthreads, [](uint64_t element) {
+    return HashingTable::ElementToHash(element) & __61_bit_mask;
+  });
+}
+
+}
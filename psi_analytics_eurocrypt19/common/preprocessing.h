@@ -0,0 +1,47 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+namespace ENCRYPTO {
+
+// Preprocessing of large input sets with nthreads threads. Duplicates have to be removed before
+// the elements are inserted into the hash tables, since the cuckoo hashing can not place several
+// copies of an element.
+
+// sorts the elements in ascending order with an LSD radix sort over 11-bit digits; digits that
+// are the same for all elements are skipped, e.g., all but two for 15-bit elements
+void RadixSort(std::vector<uint64_t> &elements, std::size_t nthreads = 1);
+
+// sorts the elements and removes the duplicates
+void SortUnique(std::vector<uint64_t> &elements, std::size_t nthreads = 1);
+
+// sorts the raw elements, removes the duplicates and maps the remaining ones with
+// HashingTable::ElementToHash to 61 bits in the same pass; the result is in the order of the
+// raw elements, i.e., not sorted
+std::vector<uint64_t> PreprocessElements(std::vector<uint64_t> elements, std::size_t nthreads = 1);
+
+}
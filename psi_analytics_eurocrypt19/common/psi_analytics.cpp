@@ -22,196 +22,740 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "psi_analytics.h"
+#include "analytics_circuit.h"
+#include "native_analytics.h"
+#include "parallel_hashing.h"
 
 #include "ENCRYPTO_utils/connection.h"
 #include "ENCRYPTO_utils/socket.h"
 #include "abycore/sharing/boolsharing.h"
 #include "abycore/sharing/sharing.h"
 
+#include "network/async_network_engine.h"
 #include "ots/ots.h"
 #include "polynomials/Poly.h"
 
-#include "HashingTables/cuckoo_hashing/cuckoo_hashing.h"
-#include "HashingTables/simple_hashing/simple_hashing.h"
 #include "psi_analytics_context.h"
 
 #include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <random>
 #include <ratio>
+#include <sstream>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace ENCRYPTO {
 
-using share_ptr = std::shared_ptr<share>;
-
 using milliseconds_ratio = std::ratio<1, 1000>;
 using duration_millis = std::chrono::duration<double, milliseconds_ratio>;
 
-uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs, PsiAnalyticsContext &context) {
+namespace {
+
+// time requests of the clock synchronization
+constexpr std::size_t nclockrequests = 8;
+
+// Both parties tell each other whether they trace. If both do, the client estimates the offset of
+// the server's clock to its own from the fastest of a few time requests (Cristian's algorithm) and
+// shifts its trace by it, so that the traces of the parties line up on one timeline.
+void SynchronizeClocks(CSocket &sock, PsiAnalyticsContext &context) {
+  auto trace = context.metrics.GetTrace();
+  // the offset of an earlier run must not shift a trace that is not synchronized in this run
+  if (trace) {
+    trace->SetClockOffset(0);
+  }
+  uint8_t tracing = trace ? 1 : 0, other_tracing = 0;
+  sock.Send(&tracing, sizeof(tracing));
+  sock.Receive(&other_tracing, sizeof(other_tracing));
+  if (!tracing || !other_tracing) {
+    return;
+  }
+
+  if (context.role == SERVER) {
+    for (auto i = 0ull; i < nclockrequests; ++i) {
+      uint8_t request;
+      sock.Receive(&request, sizeof(request));
+      const double server_time = TraceRecorder::Now();
+      sock.Send(&server_time, sizeof(server_time));
+    }
+  } else {
+    double min_round_trip = std::numeric_limits<double>::max(), offset = 0;
+    for (auto i = 0ull; i < nclockrequests; ++i) {
+      uint8_t request = 0;
+      double server_time;
+      const double start = TraceRecorder::Now();
+      sock.Send(&request, sizeof(request));
+      sock.Receive(&server_time, sizeof(server_time));
+      const double end = TraceRecorder::Now();
+      if (end - start < min_round_trip) {
+        min_round_trip = end - start;
+        offset = server_time - (start + end) / 2;
+      }
+    }
+    trace->SetClockOffset(offset);
+  }
+}
+
+// SynchronizeClocks as continuations on a socket of the network engine, so that no thread blocks
+// on the socket; on_done is called on an I/O thread, with false if the connection failed
+class ClockSynchronization : public std::enable_shared_from_this<ClockSynchronization> {
+ public:
+  ClockSynchronization(AsyncNetworkEngine &engine, int fd, const PsiAnalyticsContext &context,
+                       AsyncNetworkEngine::Completion on_done)
+      : engine_(engine),
+        fd_(fd),
+        server_(context.role == SERVER),
+        trace_(context.metrics.GetTrace()),
+        on_done_(std::move(on_done)) {}
+
+  void Start() {
+    if (trace_) {
+      trace_->SetClockOffset(0);
+    }
+    tracing_ = trace_ ? 1 : 0;
+    auto self = shared_from_this();
+    engine_.AsyncSend(fd_, &tracing_, sizeof(tracing_), Then([self]() {
+      self->engine_.AsyncReceive(self->fd_, &self->other_tracing_, sizeof(self->other_tracing_),
+                                 self->Then([self]() {
+                                   if (!self->tracing_ || !self->other_tracing_) {
+                                     self->on_done_(true);
+                                   } else if (self->server_) {
+                                     self->Reply(0);
+                                   } else {
+                                     self->Request(0);
+                                   }
+                                 }));
+    }));
+  }
+
+ private:
+  // continues with f if the operation succeeded and fails the synchronization otherwise
+  AsyncNetworkEngine::Completion Then(std::function<void()> f) {
+    auto self = shared_from_this();
+    return [self, f](bool success) {
+      if (success) {
+        f();
+      } else {
+        self->on_done_(false);
+      }
+    };
+  }
+
+  void Reply(std::size_t i) {
+    if (i == nclockrequests) {
+      on_done_(true);
+      return;
+    }
+    auto self = shared_from_this();
+    engine_.AsyncReceive(fd_, &request_, sizeof(request_), Then([self, i]() {
+      self->server_time_ = TraceRecorder::Now();
+      self->engine_.AsyncSend(self->fd_, &self->server_time_, sizeof(self->server_time_),
+                              self->Then([self, i]() { self->Reply(i + 1); }));
+    }));
+  }
+
+  void Request(std::size_t i) {
+    if (i == nclockrequests) {
+      trace_->SetClockOffset(offset_);
+      on_done_(true);
+      return;
+    }
+    auto self = shared_from_this();
+    start_ = TraceRecorder::Now();
+    engine_.AsyncSend(fd_, &request_, sizeof(request_), Then([self, i]() {
+      self->engine_.AsyncReceive(
+          self->fd_, &self->server_time_, sizeof(self->server_time_), self->Then([self, i]() {
+            const double end = TraceRecorder::Now();
+            if (end - self->start_ < self->min_round_trip_) {
+              self->min_round_trip_ = end - self->start_;
+              self->offset_ = self->server_time_ - (self->start_ + end) / 2;
+            }
+            self->Request(i + 1);
+          }));
+    }));
+  }
+
+  AsyncNetworkEngine &engine_;
+  const int fd_;
+  const bool server_;
+  const std::shared_ptr<TraceRecorder> trace_;
+  AsyncNetworkEngine::Completion on_done_;
+  uint8_t tracing_ = 0, other_tracing_ = 0, request_ = 0;
+  double server_time_ = 0, start_ = 0, offset_ = 0;
+  double min_round_trip_ = std::numeric_limits<double>::max();
+};
+
+// The connection of a run on the base port, over which the parties synchronize their clocks, see
+// SynchronizeClocks. On the network engine, the server accepts it through a listening socket of
+// the engine, the handshake runs as continuations, and the socket stays open for the polynomials
+// of the OPPRF as context.network_fd until Close or the end of the run.
+class RunConnection {
+ public:
+  explicit RunConnection(PsiAnalyticsContext &context) : context_(context) {
+    auto connection_timer = context.metrics.Time("connection");
+    if (!context.network_engine) {
+      auto sock =
+          EstablishConnection(context.address, context.port, static_cast<e_role>(context.role));
+      context.timings.connection = connection_timer.Stop();
+      SynchronizeClocks(*sock, context);
+      sock->Close();
+      return;
+    }
+
+    auto &engine = *context.network_engine;
+    std::promise<bool> synchronized;
+    auto synchronized_future = synchronized.get_future();
+    // runs on an I/O thread of the engine for the server, this thread waits until it is done
+    const auto on_connected = [&](int fd) {
+      context.network_fd = fd;
+      context.timings.connection = connection_timer.Stop();
+      if (fd < 0) {
+        synchronized.set_value(false);
+        return;
+      }
+      std::make_shared<ClockSynchronization>(engine, fd, context, [&synchronized](bool success) {
+        synchronized.set_value(success);
+      })->Start();
+    };
+    if (context.role == SERVER) {
+      engine.AsyncAccept(context.address, context.port, on_connected);
+    } else {
+      on_connected(engine.Connect(context.address, context.port));
+    }
+    if (!synchronized_future.get()) {
+      Close();
+      throw std::runtime_error("The handshake with the other party failed");
+    }
+  }
+
+  ~RunConnection() { Close(); }
+
+  void Close() {
+    if (context_.network_fd >= 0) {
+      context_.network_engine->Close(context_.network_fd);
+      context_.network_fd = -1;
+    }
+  }
+
+ private:
+  PsiAnalyticsContext &context_;
+};
+
+// Every stash bin holds all elements of the server. Its points are split into buckets by their
+// OPRF output, which the client knows for its own element, so that each bucket fits into one
+// polynomial of polynomialsize coefficients; on average, the buckets are only half full.
+std::size_t NumOfStashBuckets(const PsiAnalyticsContext &context) {
+  const auto server_neles = context.role == SERVER || context.notherpartyselems == 0
+                                ? context.neles
+                                : context.notherpartyselems;
+  return std::max<std::size_t>(ceil_divide(2 * server_neles, context.polynomialsize), 1);
+}
+
+// both parties check the payload bit length before connecting: the client derives its payload
+// mask from it, and ncategories >= 64 would shift the one-hot categories out of range
+void CheckPayloadBitlen(const PsiAnalyticsContext &context) {
+  if (context.analytics_type == PsiAnalyticsContext::GROUPED_SUM &&
+      (context.ncategories == 0 || context.ncategories > context.maxbitlen)) {
+    throw std::runtime_error("The number of categories must be in [1, 61]");
+  }
+  if (context.analytics_type == PsiAnalyticsContext::PAYLOAD_SUM &&
+      (context.payload_bitlen == 0 || context.payload_bitlen > context.maxbitlen)) {
+    throw std::runtime_error("The payload bit length must be in [1, 61]");
+  }
+}
+
+// the categories are programmed as one-hot vectors, so that the circuit can count the matches
+// of every category by summing up a single bit per bin
+std::vector<std::uint64_t> ToOneHotCategories(const std::vector<std::uint64_t> &categories,
+                                              const PsiAnalyticsContext &context) {
+  std::vector<std::uint64_t> one_hot_categories;
+  one_hot_categories.reserve(categories.size());
+  for (auto category : categories) {
+    if (category >= context.ncategories) {
+      throw std::runtime_error("Encountered a category >= ncategories");
+    }
+    one_hot_categories.push_back(1ull << category);
+  }
+  return one_hot_categories;
+}
+
+// runs hashing, OPRF, OPPRF and the analytics session, i.e., the ABY circuit or the native
+// protocol; match_shares is only used for MATCH_SHARES
+template <typename Session>
+uint64_t RunPsi(const std::vector<std::uint64_t> &inputs,
+                const std::vector<std::uint64_t> &payloads, PsiAnalyticsContext &context,
+                Session &session, MatchShares *match_shares) {
+  const bool with_payloads = context.analytics_type == PsiAnalyticsContext::PAYLOAD_SUM ||
+                             context.analytics_type == PsiAnalyticsContext::GROUPED_SUM;
+  if (with_payloads && context.role == SERVER && payloads.size() != inputs.size()) {
+    throw std::runtime_error("The server needs exactly one payload per input element");
+  }
+  CheckPayloadBitlen(context);
+
+  if (context.nshards > 1) {
+    throw std::runtime_error("Sharded runs need the ABY backend and an aggregating analytics type");
+  }
+
+  std::vector<std::uint64_t> one_hot_categories;
+  auto server_payloads = &payloads;
+  if (context.analytics_type == PsiAnalyticsContext::GROUPED_SUM && context.role == SERVER) {
+    one_hot_categories = ToOneHotCategories(payloads, context);
+    server_payloads = &one_hot_categories;
+  }
+
+  // a context may be reused across queries, and not every backend sets every field
+  context.timings = {};
+  context.communication = {};
+  context.metrics.Clear();
+
   // establish network connection
-  std::unique_ptr<CSocket> sock =
-      EstablishConnection(context.address, context.port, static_cast<e_role>(context.role));
-  sock->Close();
-  const auto clock_time_total_start = std::chrono::system_clock::now();
+  RunConnection connection(context);
+  auto total_timer = context.metrics.Time("total");
+
+  // the input-independent part of the analytics runs concurrently with the OPPRF
+  auto aby_preparation = std::async(std::launch::async, [&session]() { return session.Prepare(); });
 
   // create hash tables from the elements
-  std::vector<uint64_t> bins;
-  if (context.role == CLIENT) {
-    bins = OpprgPsiClient(inputs, context);
-  } else {
-    bins = OpprgPsiServer(inputs, context);
+  std::vector<uint64_t> bins, payload_bins;
+  try {
+    if (context.role == CLIENT) {
+      bins = OpprgPsiClient(inputs, context, with_payloads ? &payload_bins : nullptr, match_shares);
+    } else {
+      bins = OpprgPsiServer(inputs, context, *server_payloads,
+                            with_payloads ? &payload_bins : nullptr, match_shares);
+    }
+  } catch (...) {
+    // the preparation might wait for the other party forever, and the future for the preparation
+    session.Abort();
+    throw;
   }
+  connection.Close();
 
-  // instantiate ABY
-  ABYParty party(static_cast<e_role>(context.role), context.address, context.port, LT, 64,
-                 context.nthreads);
-  party.ConnectAndBaseOTs();
-  auto bc = dynamic_cast<BooleanCircuit *>(
-      party.GetSharings().at(S_BOOL)->GetCircuitBuildRoutine());  // GMW circuit
-  assert(bc);
+  auto waiting_timer = context.metrics.Time("analytics/preparation_waiting");
+  context.timings.aby_preparation = aby_preparation.get();
+  context.timings.aby_preparation_hidden =
+      std::max(context.timings.aby_preparation - waiting_timer.Stop(), 0.0);
+  context.metrics.Add("analytics/preparation", context.timings.aby_preparation);
 
-  share_ptr s_in_server, s_in_client;
+  const auto output = session.Execute(bins, context, payload_bins,
+                                      match_shares ? &match_shares->bits : nullptr);
 
-  // share inputs in ABY
-  if (context.role == SERVER) {
-    s_in_server = share_ptr(bc->PutSIMDINGate(bins.size(), bins.data(), context.maxbitlen, SERVER));
-    s_in_client = share_ptr(bc->PutDummySIMDINGate(bins.size(), context.maxbitlen));
-  } else {
-    s_in_server = share_ptr(bc->PutDummySIMDINGate(bins.size(), context.maxbitlen));
-    s_in_client = share_ptr(bc->PutSIMDINGate(bins.size(), bins.data(), context.maxbitlen, CLIENT));
-  }
-
-  // compare outputs of OPPRFs for each bin in ABY (using SIMD)
-  auto s_eq = share_ptr(bc->PutEQGate(s_in_server.get(), s_in_client.get()));
-
-  std::vector<share_ptr> bin_results;
-  for (uint32_t i = 0; i < bins.size(); ++i) {
-    uint32_t pos[] = {i};
-    bin_results.emplace_back(bc->PutSubsetGate(s_eq.get(), pos, 1));
-    bin_results.at(i) = share_ptr(bc->PutOUTGate(bin_results.at(i).get(), ALL));
-  }
-
-  share_ptr s_out;
-  auto t_bitlen = static_cast<std::size_t>(std::ceil(std::log2(context.threshold + 1)));
-  auto s_threshold = share_ptr(bc->PutCONSGate(context.threshold, t_bitlen));
-  std::uint64_t const_zero = 0;
-  auto s_zero = share_ptr(bc->PutCONSGate(const_zero, 1));
-
-  if (context.analytics_type == PsiAnalyticsContext::NONE) {
-    // we want to only do benchmarking, so no additional operations
-  } else if (context.analytics_type == PsiAnalyticsContext::THRESHOLD) {
-    auto s_eq_rotated = share_ptr(bc->PutSplitterGate(s_eq.get()));
-    s_out = share_ptr(bc->PutHammingWeightGate(s_eq_rotated.get()));
-    s_out = share_ptr(bc->PutGTGate(s_out.get(), s_threshold.get()));
-  } else if (context.analytics_type == PsiAnalyticsContext::SUM) {
-    auto s_eq_rotated = share_ptr(bc->PutSplitterGate(s_eq.get()));
-    s_out = share_ptr(bc->PutHammingWeightGate(s_eq_rotated.get()));
-  } else if (context.analytics_type == PsiAnalyticsContext::SUM_IF_GT_THRESHOLD) {
-    auto s_eq_rotated = share_ptr(bc->PutSplitterGate(s_eq.get()));
-    s_out = share_ptr(bc->PutHammingWeightGate(s_eq_rotated.get()));
-    auto s_gt_t = share_ptr(bc->PutGTGate(s_out.get(), s_threshold.get()));
-    s_out = share_ptr(bc->PutMUXGate(s_out.get(), s_zero.get(), s_gt_t.get()));
-  } else {
-    throw std::runtime_error("Encountered an unknown analytics type");
+  context.timings.total = total_timer.Stop();
+
+  return output;
+}
+
+template <typename Session>
+MatchShares RunPsiMatchShares(const std::vector<std::uint64_t> &inputs,
+                              PsiAnalyticsContext &context, Session &session) {
+  if (context.analytics_type != PsiAnalyticsContext::MATCH_SHARES) {
+    throw std::runtime_error("Match shares require the MATCH_SHARES analytics type");
   }
+  MatchShares match_shares;
+  RunPsi(inputs, {}, context, session, &match_shares);
+  return match_shares;
+}
 
-  if (context.analytics_type != PsiAnalyticsContext::NONE) {
-    s_out = share_ptr(bc->PutOUTGate(s_out.get(), ALL));
+void AddTimings(PsiAnalyticsContext &context, const PsiAnalyticsContext &shard_context) {
+  auto &timings = context.timings;
+  const auto &shard_timings = shard_context.timings;
+  timings.hashing += shard_timings.hashing;
+  timings.base_ots_aby += shard_timings.base_ots_aby;
+  timings.base_ots_libote += shard_timings.base_ots_libote;
+  timings.oprf += shard_timings.oprf;
+  timings.opprf += shard_timings.opprf;
+  timings.polynomials += shard_timings.polynomials;
+  timings.polynomials_transmission += shard_timings.polynomials_transmission;
+  timings.circuit_construction += shard_timings.circuit_construction;
+  timings.aby_setup += shard_timings.aby_setup;
+  timings.aby_online += shard_timings.aby_online;
+  timings.aby_total += shard_timings.aby_total;
+
+  auto &communication = context.communication;
+  const auto &shard_communication = shard_context.communication;
+  communication.base_ots_aby += shard_communication.base_ots_aby;
+  communication.base_ots_libote += shard_communication.base_ots_libote;
+  communication.oprf += shard_communication.oprf;
+  communication.polynomials += shard_communication.polynomials;
+  communication.aby_setup += shard_communication.aby_setup;
+  communication.aby_online += shard_communication.aby_online;
+
+  context.metrics.Merge(shard_context.metrics);
+}
+
+// Runs the PSI shard by shard, see PsiAnalyticsContext::nshards. Every shard is a complete run of
+// hashing, OPRF, OPPRF and circuit on the elements of both parties that fall into it, sized for
+// ShardCapacity elements and a share of the mega bins. The circuits of the shards output shares
+// of their aggregates, which are added up locally; only the last circuit reveals the outputs.
+uint64_t RunShardedPsi(const std::vector<std::uint64_t> &inputs,
+                       const std::vector<std::uint64_t> &payloads, PsiAnalyticsContext &context,
+                       AnalyticsCircuitSession &session) {
+  const bool with_payloads = context.analytics_type == PsiAnalyticsContext::PAYLOAD_SUM ||
+                             context.analytics_type == PsiAnalyticsContext::GROUPED_SUM;
+  const bool server_payloads = with_payloads && context.role == SERVER;
+  if (server_payloads && payloads.size() != inputs.size()) {
+    throw std::runtime_error("The server needs exactly one payload per input element");
+  }
+  CheckPayloadBitlen(context);
+  const auto nshards = context.nshards;
+
+  // the shard of every element; the shards are gathered one after the other from it, so only the
+  // elements of the current shard are held a second time
+  std::vector<std::uint32_t> element_shards(inputs.size());
+  std::vector<std::size_t> shard_sizes(nshards, 0);
+  for (auto i = 0ull; i < inputs.size(); ++i) {
+    element_shards.at(i) = static_cast<std::uint32_t>(ShardOf(inputs.at(i), nshards));
+    ++shard_sizes.at(element_shards.at(i));
+  }
+  std::vector<std::uint64_t> one_hot_categories;
+  if (server_payloads && context.analytics_type == PsiAnalyticsContext::GROUPED_SUM) {
+    one_hot_categories = ToOneHotCategories(payloads, context);
   }
+  const auto &unsharded_payloads = one_hot_categories.empty() ? payloads : one_hot_categories;
+
+  const auto other_neles = context.notherpartyselems == 0 ? context.neles
+                                                          : context.notherpartyselems;
+  const auto client_neles = context.role == CLIENT ? context.neles : other_neles;
+  const auto server_neles = context.role == SERVER ? context.neles : other_neles;
+  const auto client_capacity = ShardCapacity(client_neles, nshards);
+  const auto server_capacity = ShardCapacity(server_neles, nshards);
+  const auto capacity = context.role == CLIENT ? client_capacity : server_capacity;
+  for (auto shard_size : shard_sizes) {
+    if (shard_size > capacity) {
+      throw std::runtime_error("A shard has more elements than its capacity");
+    }
+  }
+
+  context.timings = {};
+  context.communication = {};
+  context.metrics.Clear();
+
+  RunConnection connection(context);
+  auto total_timer = context.metrics.Time("total");
+  auto aby_preparation = std::async(std::launch::async, [&session]() { return session.Prepare(); });
+
+  std::vector<uint64_t> aggregate_shares;
+  std::vector<std::uint64_t> shard_inputs, shard_payloads;
+  shard_inputs.reserve(capacity);
+  shard_payloads.reserve(server_payloads ? capacity : 0);
+  for (auto s = 0ull; s < nshards; ++s) {
+    PsiAnalyticsContext shard_context(context);
+    shard_context.timings = {};
+    shard_context.communication = {};
+    shard_context.metrics.Clear();
+    shard_context.neles = capacity;
+    shard_context.notherpartyselems = context.role == CLIENT ? server_capacity : client_capacity;
+    shard_context.nbins = std::max<uint64_t>(
+        ceil_divide(context.nbins * client_capacity, std::max<uint64_t>(client_neles, 1)), 1);
+    shard_context.nmegabins = std::max<uint64_t>(ceil_divide(context.nmegabins, nshards), 1);
+    // polynomialsize is given for the mega bins of all elements; a shard's mega bins hold
+    // server_capacity * nmegabins / (server_neles * shard nmegabins) times as many points
+    shard_context.polynomialsize = std::max<uint64_t>(
+        ceil_divide(context.polynomialsize * server_capacity * context.nmegabins,
+                    std::max<uint64_t>(server_neles, 1) * shard_context.nmegabins),
+        1);
+    shard_context.polynomialbytelength = shard_context.polynomialsize * sizeof(std::uint64_t);
+
+    shard_inputs.clear();
+    shard_payloads.clear();
+    for (auto i = 0ull; i < inputs.size(); ++i) {
+      if (element_shards.at(i) == s) {
+        shard_inputs.push_back(inputs.at(i));
+        if (server_payloads) {
+          shard_payloads.push_back(unsharded_payloads.at(i));
+        }
+      }
+    }
+
+    std::vector<uint64_t> bins, payload_bins;
+    try {
+      if (context.role == CLIENT) {
+        bins = OpprgPsiClient(shard_inputs, shard_context, with_payloads ? &payload_bins : nullptr);
+      } else {
+        bins = OpprgPsiServer(shard_inputs, shard_context, shard_payloads,
+                              with_payloads ? &payload_bins : nullptr);
+      }
+    } catch (...) {
+      // see RunPsi; the other party may also wait in the circuit of an earlier shard
+      session.Abort();
+      throw;
+    }
 
-  party.ExecCircuit();
+    if (s == 0) {
+      auto waiting_timer = context.metrics.Time("analytics/preparation_waiting");
+      context.timings.aby_preparation = aby_preparation.get();
+      context.timings.aby_preparation_hidden =
+          std::max(context.timings.aby_preparation - waiting_timer.Stop(), 0.0);
+      context.metrics.Add("analytics/preparation", context.timings.aby_preparation);
+    }
 
-  uint64_t output = 0;
-  if (context.analytics_type != PsiAnalyticsContext::NONE) {
-    output = s_out->get_clear_value<uint64_t>();
+    session.ExecuteShard(bins, shard_context, payload_bins, aggregate_shares);
+    AddTimings(context, shard_context);
   }
+  connection.Close();
 
-  context.timings.aby_setup = party.GetTiming(P_SETUP);
-  context.timings.aby_online = party.GetTiming(P_ONLINE);
-  context.timings.aby_total = context.timings.aby_setup + context.timings.aby_online;
-  context.timings.base_ots_aby = party.GetTiming(P_BASE_OT);
+  PsiAnalyticsContext combination_context(context);
+  combination_context.timings = {};
+  combination_context.communication = {};
+  combination_context.metrics.Clear();
+  const auto output = session.ExecuteCombination(aggregate_shares, combination_context,
+                                                 client_neles);
+  context.outputs = combination_context.outputs;
+  AddTimings(context, combination_context);
 
-  const auto clock_time_total_end = std::chrono::system_clock::now();
-  const duration_millis clock_time_total_duration = clock_time_total_end - clock_time_total_start;
-  context.timings.total = clock_time_total_duration.count();
+  context.timings.total = total_timer.Stop();
 
   return output;
 }
 
-std::vector<uint64_t> OpprgPsiClient(const std::vector<uint64_t> &elements,
-                                     PsiAnalyticsContext &context) {
-  const auto start_time = std::chrono::system_clock::now();
-  const auto hashing_start_time = std::chrono::system_clock::now();
+}  // namespace
+
+uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs, PsiAnalyticsContext &context) {
+  AnalyticsCircuitSession session(context);
+  return run_psi_analytics(inputs, {}, context, session);
+}
 
-  ENCRYPTO::CuckooTable cuckoo_table(static_cast<std::size_t>(context.nbins));
-  cuckoo_table.SetNumOfHashFunctions(context.nfuns);
-  cuckoo_table.Insert(elements);
-  cuckoo_table.MapElements();
-  // cuckoo_table.Print();
+uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs,
+                           const std::vector<std::uint64_t> &payloads,
+                           PsiAnalyticsContext &context) {
+  if (context.analytics_backend == PsiAnalyticsContext::NATIVE) {
+    NativeAnalyticsSession session(context);
+    return run_psi_analytics(inputs, payloads, context, session);
+  }
+  AnalyticsCircuitSession session(context);
+  return run_psi_analytics(inputs, payloads, context, session);
+}
+
+uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs, PsiAnalyticsContext &context,
+                           AnalyticsCircuitSession &session) {
+  return run_psi_analytics(inputs, {}, context, session);
+}
+
+uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs,
+                           const std::vector<std::uint64_t> &payloads,
+                           PsiAnalyticsContext &context, AnalyticsCircuitSession &session) {
+  if (context.analytics_type == PsiAnalyticsContext::MATCH_SHARES) {
+    throw std::runtime_error("Match shares are only returned by run_psi_match_shares");
+  }
+  if (context.nshards > 1) {
+    return RunShardedPsi(inputs, payloads, context, session);
+  }
+  return RunPsi(inputs, payloads, context, session, nullptr);
+}
+
+uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs,
+                           const std::vector<std::uint64_t> &payloads,
+                           PsiAnalyticsContext &context, NativeAnalyticsSession &session) {
+  if (context.analytics_type == PsiAnalyticsContext::MATCH_SHARES) {
+    throw std::runtime_error("Match shares are only returned by run_psi_match_shares");
+  }
+  return RunPsi(inputs, payloads, context, session, nullptr);
+}
+
+MatchShares run_psi_match_shares(const std::vector<std::uint64_t> &inputs,
+                                 PsiAnalyticsContext &context) {
+  if (context.analytics_backend == PsiAnalyticsContext::NATIVE) {
+    NativeAnalyticsSession session(context);
+    return run_psi_match_shares(inputs, context, session);
+  }
+  AnalyticsCircuitSession session(context);
+  return run_psi_match_shares(inputs, context, session);
+}
 
-  if (cuckoo_table.GetStashSize() > 0u) {
-    std::cerr << "[Error] Stash of size " << cuckoo_table.GetStashSize() << " occured\n";
+MatchShares run_psi_match_shares(const std::vector<std::uint64_t> &inputs,
+                                 PsiAnalyticsContext &context, AnalyticsCircuitSession &session) {
+  return RunPsiMatchShares(inputs, context, session);
+}
+
+MatchShares run_psi_match_shares(const std::vector<std::uint64_t> &inputs,
+                                 PsiAnalyticsContext &context, NativeAnalyticsSession &session) {
+  return RunPsiMatchShares(inputs, context, session);
+}
+
+std::vector<uint64_t> OpprgPsiClient(const std::vector<uint64_t> &elements,
+                                     PsiAnalyticsContext &context,
+                                     std::vector<uint64_t> *payload_bins,
+                                     MatchShares *match_shares) {
+  auto opprf_timer = context.metrics.Time("opprf");
+  auto hashing_timer = context.metrics.Time("opprf/hashing");
+
+  std::vector<uint64_t> stash;
+  auto cuckoo_table_v = ParallelCuckooHashing(elements, context, &stash);
+
+  // the stashed elements get the stash bins, which the server fills with all of its elements;
+  // the remaining stash bins stay empty like the empty bins of the table. Without a stash bin, an
+  // element would silently be missing from the intersection
+  if (stash.size() > context.nstashbins) {
+    throw std::runtime_error("Cuckoo hashing stashed " + std::to_string(stash.size()) +
+                             " elements, but there are only " +
+                             std::to_string(context.nstashbins) + " stash bins");
+  }
+  for (auto i = 0ull; i < context.nstashbins; ++i) {
+    cuckoo_table_v.push_back(i < stash.size() ? stash.at(i) : cuckoo_empty_bin);
   }
 
-  auto cuckoo_table_v = cuckoo_table.AsRawVector();
+  // the empty bins are not exported
+  if (match_shares) {
+    match_shares->role = context.role;
+    match_shares->nbins = cuckoo_table_v.size();
+    match_shares->offsets.assign(1, 0);
+    match_shares->elements.clear();
+    for (auto element : cuckoo_table_v) {
+      if (element != cuckoo_empty_bin) {
+        match_shares->elements.push_back(element);
+      }
+      match_shares->offsets.push_back(match_shares->elements.size());
+    }
+  }
 
-  const auto hashing_end_time = std::chrono::system_clock::now();
-  const duration_millis hashing_duration = hashing_end_time - hashing_start_time;
-  context.timings.hashing = hashing_duration.count();
-  const auto oprf_start_time = std::chrono::system_clock::now();
+  context.timings.hashing = hashing_timer.Stop();
+  auto oprf_timer = context.metrics.Time("opprf/oprf");
 
   std::vector<uint64_t> masks_with_dummies = ot_receiver(cuckoo_table_v, context);
-  
-  const auto oprf_end_time = std::chrono::system_clock::now();
-  const duration_millis oprf_duration = oprf_end_time - oprf_start_time;
-  context.timings.oprf = oprf_duration.count();
 
-  std::unique_ptr<CSocket> sock =
-      EstablishConnection(context.address, context.port, static_cast<e_role>(context.role));
+  context.timings.oprf = oprf_timer.Stop();
+
+  // the polynomial phases are not timed as a whole, so their memory is measured explicitly
+  std::unique_ptr<MemoryPhase> polynomials_memory;
+  if (context.metrics.TracksMemory()) {
+    polynomials_memory = std::make_unique<MemoryPhase>();
+  }
+
+  std::unique_ptr<CSocket> sock;
+  int fd = context.network_fd;
+  const bool own_fd = context.network_engine && fd < 0;
+  if (own_fd) {
+    fd = context.network_engine->Connect(context.address, context.port);
+  } else if (!context.network_engine) {
+    sock = EstablishConnection(context.address, context.port, static_cast<e_role>(context.role));
+  }
 
   const auto nbinsinmegabin = ceil_divide(context.nbins, context.nmegabins);
-  std::vector<std::vector<ZpMersenneLongElement>> polynomials(context.nmegabins);
-  std::vector<ZpMersenneLongElement> X(context.nbins), Y(context.nbins);
+  // every mega bin is followed by the polynomial of the masked payloads if there are any
+  const std::size_t npolynomials = payload_bins ? 2 : 1;
+  const auto megabinbytelength = npolynomials * context.polynomialbytelength;
+  // the buckets of the stash bins follow the mega bins in the same layout
+  const auto nstashbuckets = NumOfStashBuckets(context);
+  const auto stashbytelength = context.nstashbins * nstashbuckets * megabinbytelength;
+  std::vector<std::vector<ZpMersenneLongElement>> polynomials(context.nmegabins * npolynomials);
+  std::vector<ZpMersenneLongElement> X(cuckoo_table_v.size()), Y(cuckoo_table_v.size()),
+      Y_payloads;
   for (auto &polynomial : polynomials) {
     polynomial.resize(context.polynomialsize);
   }
+  if (payload_bins) {
+    Y_payloads.resize(X.size());
+  }
 
   for (auto i = 0ull; i < X.size(); ++i) {
     X.at(i).elem = masks_with_dummies.at(i);
   }
 
-  std::vector<uint8_t> poly_rcv_buffer(context.nmegabins * context.polynomialbytelength, 0);
-  
-  const auto receiving_start_time = std::chrono::system_clock::now();
-  
-  sock->Receive(poly_rcv_buffer.data(), context.nmegabins * context.polynomialbytelength);
-  sock->Close();
-  
-  const auto receiving_end_time = std::chrono::system_clock::now();
-  const duration_millis sending_duration = receiving_end_time - receiving_start_time;
-  context.timings.polynomials_transmission = sending_duration.count();
+  std::vector<uint8_t> poly_rcv_buffer(context.nmegabins * megabinbytelength + stashbytelength,
+                                       0);
 
-  const auto eval_poly_start_time = std::chrono::system_clock::now();
-  for (auto poly_i = 0ull; poly_i < polynomials.size(); ++poly_i) {
-    for (auto coeff_i = 0ull; coeff_i < context.polynomialsize; ++coeff_i) {
-      polynomials.at(poly_i).at(coeff_i).elem = (reinterpret_cast<uint64_t *>(
-          poly_rcv_buffer.data()))[poly_i * context.polynomialsize + coeff_i];
+  const auto receiving_start_time = MetricsRegistry::Clock::now();
+
+  // with the network engine, the mega bins are evaluated as they arrive
+  std::vector<std::future<bool>> received_megabins;
+  if (context.network_engine) {
+    received_megabins.reserve(context.nmegabins);
+    for (auto poly_i = 0ull; poly_i < context.nmegabins; ++poly_i) {
+      received_megabins.push_back(context.network_engine->Receive(
+          fd, poly_rcv_buffer.data() + poly_i * megabinbytelength, megabinbytelength));
+    }
+    if (stashbytelength > 0) {
+      received_megabins.push_back(context.network_engine->Receive(
+          fd, poly_rcv_buffer.data() + context.nmegabins * megabinbytelength, stashbytelength));
     }
+  } else {
+    TraceRecorder::Scope receiving(context.metrics.GetTrace(), "receive polynomials", "opprf");
+    sock->Receive(poly_rcv_buffer.data(), poly_rcv_buffer.size());
+    sock->Close();
   }
+  context.communication.polynomials = {};
+  context.communication.polynomials.received_bytes = poly_rcv_buffer.size();
+  context.communication.polynomials.received_messages =
+      context.network_engine ? received_megabins.size() : 1;
+
+  const auto receiving_end_time = MetricsRegistry::Clock::now();
+  const duration_millis receiving_duration = receiving_end_time - receiving_start_time;
+  duration_millis waiting_duration(0);
+
+  const auto eval_poly_start_time = MetricsRegistry::Clock::now();
+  for (auto poly_i = 0ull; poly_i < context.nmegabins; ++poly_i) {
+    if (context.network_engine) {
+      TraceRecorder::Scope waiting(context.metrics.GetTrace(),
+                                   "wait for mega bin " + std::to_string(poly_i), "opprf");
+      const auto waiting_start_time = MetricsRegistry::Clock::now();
+      if (!received_megabins.at(poly_i).get()) {
+        throw std::runtime_error("Could not receive the polynomials");
+      }
+      waiting_duration += MetricsRegistry::Clock::now() - waiting_start_time;
+    }
+    TraceRecorder::Scope evaluation(context.metrics.GetTrace(),
+                                    "evaluate mega bin " + std::to_string(poly_i), "opprf");
 
-  for (auto i = 0ull; i < X.size(); ++i) {
-    std::size_t p = i / nbinsinmegabin;
-    Poly::evalMersenne(Y.at(i), polynomials.at(p), X.at(i));
+    for (auto j = poly_i * npolynomials; j < (poly_i + 1) * npolynomials; ++j) {
+      for (auto coeff_i = 0ull; coeff_i < context.polynomialsize; ++coeff_i) {
+        polynomials.at(j).at(coeff_i).elem = (reinterpret_cast<uint64_t *>(
+            poly_rcv_buffer.data()))[j * context.polynomialsize + coeff_i];
+      }
+    }
+
+    const auto last_bin = std::min<std::size_t>((poly_i + 1) * nbinsinmegabin, context.nbins);
+    for (auto i = poly_i * nbinsinmegabin; i < last_bin; ++i) {
+      Poly::evalMersenne(Y.at(i), polynomials.at(poly_i * npolynomials), X.at(i));
+      if (payload_bins) {
+        Poly::evalMersenne(Y_payloads.at(i), polynomials.at(poly_i * npolynomials + 1), X.at(i));
+      }
+    }
+  }
+
+  if (stashbytelength > 0 && context.network_engine) {
+    TraceRecorder::Scope waiting(context.metrics.GetTrace(), "wait for stash bins", "opprf");
+    const auto waiting_start_time = MetricsRegistry::Clock::now();
+    if (!received_megabins.back().get()) {
+      throw std::runtime_error("Could not receive the polynomials");
+    }
+    waiting_duration += MetricsRegistry::Clock::now() - waiting_start_time;
   }
 
-  const auto eval_poly_end_time = std::chrono::system_clock::now();
+  // only the bucket of the own element is evaluated in every stash bin
+  std::vector<ZpMersenneLongElement> stash_polynomial(context.polynomialsize);
+  for (auto i = context.nbins; i < X.size(); ++i) {
+    const auto bucket = BucketOf(X.at(i).elem & __61_bit_mask, nstashbuckets);
+    auto coefficients = reinterpret_cast<const uint64_t *>(
+        poly_rcv_buffer.data() +
+        (context.nmegabins + (i - context.nbins) * nstashbuckets + bucket) * megabinbytelength);
+    for (auto j = 0ull; j < npolynomials; ++j) {
+      for (auto &coefficient : stash_polynomial) {
+        coefficient.elem = *coefficients++;
+      }
+      Poly::evalMersenne(j == 0 ? Y.at(i) : Y_payloads.at(i), stash_polynomial, X.at(i));
+    }
+  }
+
+  if (own_fd) {
+    context.network_engine->Close(fd);
+  }
+
+  const auto eval_poly_end_time = MetricsRegistry::Clock::now();
   const duration_millis eval_poly_duration = eval_poly_end_time - eval_poly_start_time;
-  context.timings.polynomials = eval_poly_duration.count();
+  context.timings.polynomials_transmission = (receiving_duration + waiting_duration).count();
+  context.timings.polynomials = (eval_poly_duration - waiting_duration).count();
+  context.metrics.Add("opprf/polynomials", context.timings.polynomials);
+  context.metrics.Add("opprf/polynomials_transmission", context.timings.polynomials_transmission);
+  if (polynomials_memory) {
+    context.metrics.AddMemoryUsage("opprf/polynomials", polynomials_memory->End());
+  }
 
   std::vector<uint64_t> raw_bin_result;
   raw_bin_result.reserve(X.size());
@@ -219,44 +763,64 @@ std::vector<uint64_t> OpprgPsiClient(const std::vector<uint64_t> &elements,
     raw_bin_result.push_back(X[i].elem ^ Y[i].elem);
   }
 
-  const auto end_time = std::chrono::system_clock::now();
-  const duration_millis total_duration = end_time - start_time;
-  context.timings.total = total_duration.count();
+  // payload ^ payload mask of the server if the bin matched, random otherwise; all 61 bits are
+  // random either way, and only the low bits are kept like the server does with its masks
+  if (payload_bins) {
+    const auto payload_mask = (1ull << context.GetPayloadBitlen()) - 1;
+    payload_bins->resize(X.size());
+    for (auto i = 0ull; i < X.size(); ++i) {
+      payload_bins->at(i) = (X[i].elem ^ Y_payloads[i].elem) & payload_mask;
+    }
+  }
+
+  context.timings.opprf = opprf_timer.Stop();
 
   return raw_bin_result;
 }
 
 std::vector<uint64_t> OpprgPsiServer(const std::vector<uint64_t> &elements,
-                                     PsiAnalyticsContext &context) {
-  const auto start_time = std::chrono::system_clock::now();
+                                     PsiAnalyticsContext &context,
+                                     const std::vector<uint64_t> &payloads,
+                                     std::vector<uint64_t> *payload_bins,
+                                     MatchShares *match_shares) {
+  auto opprf_timer = context.metrics.Time("opprf");
 
-  const auto hashing_start_time = std::chrono::system_clock::now();
+  auto hashing_timer = context.metrics.Time("opprf/hashing");
 
-  ENCRYPTO::SimpleTable simple_table(static_cast<std::size_t>(context.nbins));
-  simple_table.SetNumOfHashFunctions(context.nfuns);
-  simple_table.Insert(elements);
-  simple_table.MapElements();
-  // simple_table.Print();
+  auto simple_table = ParallelSimpleHashing(elements, context);
 
-  auto simple_table_v = simple_table.AsRaw2DVector();
-  // context.simple_table = simple_table_v;
+  // every stash bin may hold any of the client's elements
+  for (auto i = 0ull; i < context.nstashbins; ++i) {
+    simple_table.AppendBin(elements.begin(), elements.end());
+  }
+  const auto nbins = simple_table.GetNumOfBins();
 
-  const auto hashing_end_time = std::chrono::system_clock::now();
-  const duration_millis hashing_duration = hashing_end_time - hashing_start_time;
-  context.timings.hashing = hashing_duration.count();
+  if (match_shares) {
+    match_shares->role = context.role;
+    match_shares->nbins = nbins;
+    match_shares->offsets = simple_table.offsets;
+    match_shares->elements = simple_table.elements;
+  }
+
+  context.timings.hashing = hashing_timer.Stop();
 
-  const auto oprf_start_time = std::chrono::system_clock::now();
+  auto oprf_timer = context.metrics.Time("opprf/oprf");
 
-  auto masks = ot_sender(simple_table_v, context);
+  const auto masks = ot_sender(simple_table, context);
 
-  const auto oprf_end_time = std::chrono::system_clock::now();
-  const duration_millis oprf_duration = oprf_end_time - oprf_start_time;
-  context.timings.oprf = oprf_duration.count();
+  context.timings.oprf = oprf_timer.Stop();
 
-  const auto polynomials_start_time = std::chrono::system_clock::now();
+  auto polynomials_timer = context.metrics.Time("opprf/polynomials");
 
-  std::vector<uint64_t> polynomials(context.nmegabins * context.polynomialsize, 0);
-  std::vector<uint64_t> content_of_bins(context.nbins);
+  const std::size_t npolynomials = payload_bins ? 2 : 1;
+  const auto megabinbytelength = npolynomials * context.polynomialbytelength;
+  const auto nstashbuckets = NumOfStashBuckets(context);
+  const auto stashbytelength = context.nstashbins * nstashbuckets * megabinbytelength;
+  std::vector<uint64_t> polynomials(
+      (context.nmegabins + context.nstashbins * nstashbuckets) * npolynomials *
+          context.polynomialsize,
+      0);
+  std::vector<uint64_t> content_of_bins(nbins);
 
   std::random_device urandom("/dev/urandom");
   std::uniform_int_distribution<uint64_t> dist(0,
@@ -272,92 +836,243 @@ std::vector<uint64_t> OpprgPsiServer(const std::vector<uint64_t> &elements,
     assert(tmp.size() == content_of_bins.size());
   }
 
-  std::unique_ptr<CSocket> sock =
-      EstablishConnection(context.address, context.port, static_cast<e_role>(context.role));
+  // every element is programmed to its payload XOR a random mask of its bin, the masks are the
+  // server's payload shares in the circuit; the masked payloads are laid out like the masks
+  std::vector<uint64_t> masked_payloads;
+  if (payload_bins) {
+    if (context.GetPayloadBitlen() == 0 || context.GetPayloadBitlen() > context.maxbitlen) {
+      throw std::runtime_error("The payload bit length must be in [1, 61]");
+    }
+    const auto payload_mask = (1ull << context.GetPayloadBitlen()) - 1;
+
+    std::unordered_map<uint64_t, uint64_t> payload_of_element;
+    payload_of_element.reserve(elements.size());
+    for (auto i = 0ull; i < elements.size(); ++i) {
+      if (payloads.at(i) > payload_mask) {
+        throw std::runtime_error("A payload exceeds the payload bit length");
+      }
+      payload_of_element[elements.at(i)] = payloads.at(i);
+    }
+
+    // the masks span all 61 bits: the client sees the whole programmed value, so a mask of only
+    // payload_bitlen bits would leave the high bits of the matched bins zero and reveal them
+    payload_bins->resize(nbins);
+    std::generate(payload_bins->begin(), payload_bins->end(), [&]() { return dist(urandom); });
+
+    masked_payloads.resize(simple_table.elements.size());
+    for (auto bin_i = 0ull; bin_i < nbins; ++bin_i) {
+      for (auto k = simple_table.offsets.at(bin_i); k < simple_table.offsets.at(bin_i + 1); ++k) {
+        masked_payloads.at(k) =
+            payload_of_element.at(simple_table.elements.at(k)) ^ payload_bins->at(bin_i);
+      }
+    }
+
+    // both shares are truncated to the payload bit length, see OpprgPsiClient
+    for (auto &payload_share : *payload_bins) {
+      payload_share &= payload_mask;
+    }
+  }
+  // only the OPRF outputs of the elements are needed from here on
+  simple_table = BinnedElements();
+
+  std::unique_ptr<CSocket> sock;
+  int fd = context.network_fd;
+  const bool own_fd = context.network_engine && fd < 0;
+  std::vector<std::future<bool>> sent_megabins;
+  std::function<void(std::size_t)> on_megabin_interpolated;
+  if (context.network_engine) {
+    if (own_fd) {
+      fd = context.network_engine->Accept(context.address, context.port);
+    }
+    // stream every mega bin to the client as soon as its polynomial is interpolated
+    sent_megabins.reserve(context.nmegabins);
+    on_megabin_interpolated = [&](std::size_t mega_bin_i) {
+      sent_megabins.push_back(context.network_engine->Send(
+          fd, polynomials.data() + mega_bin_i * npolynomials * context.polynomialsize,
+          megabinbytelength));
+    };
+  } else {
+    sock = EstablishConnection(context.address, context.port, static_cast<e_role>(context.role));
+  }
 
-  InterpolatePolynomials(polynomials, content_of_bins, masks, context);
+  InterpolatePolynomials(polynomials, content_of_bins, masks, context, on_megabin_interpolated,
+                         masked_payloads);
+  if (context.network_engine && stashbytelength > 0) {
+    sent_megabins.push_back(context.network_engine->Send(
+        fd, polynomials.data() + context.nmegabins * npolynomials * context.polynomialsize,
+        stashbytelength));
+  }
 
-  const auto polynomials_end_time = std::chrono::system_clock::now();
-  const duration_millis polynomials_duration = polynomials_end_time - polynomials_start_time;
-  context.timings.polynomials = polynomials_duration.count();
-  const auto sending_start_time = std::chrono::system_clock::now();
+  context.timings.polynomials = polynomials_timer.Stop();
+  auto sending_timer = context.metrics.Time("opprf/polynomials_transmission");
 
   // send polynomials to the receiver
-  sock->Send((uint8_t *)polynomials.data(), context.nmegabins * context.polynomialbytelength);
-  sock->Close();
+  if (context.network_engine) {
+    for (auto &sent : sent_megabins) {
+      if (!sent.get()) {
+        throw std::runtime_error("Could not send the polynomials");
+      }
+    }
+    if (own_fd) {
+      context.network_engine->Close(fd);
+    }
+  } else {
+    sock->Send((uint8_t *)polynomials.data(),
+               context.nmegabins * megabinbytelength + stashbytelength);
+    sock->Close();
+  }
+  context.communication.polynomials = {};
+  context.communication.polynomials.sent_bytes =
+      context.nmegabins * megabinbytelength + stashbytelength;
+  context.communication.polynomials.sent_messages =
+      context.network_engine ? sent_megabins.size() : 1;
 
-  const auto sending_end_time = std::chrono::system_clock::now();
-  const duration_millis sending_duration = sending_end_time - sending_start_time;
-  context.timings.polynomials_transmission = sending_duration.count();
-  const auto end_time = std::chrono::system_clock::now();
-  const duration_millis total_duration = end_time - start_time;
+  context.timings.polynomials_transmission = sending_timer.Stop();
+  context.timings.opprf = opprf_timer.Stop();
 
   return content_of_bins;
 }
 
+namespace {
+
+// programs X ^ value_of(bin, k) for the elements of nbins_in_megabin bins from first_bin on, where
+// k is the index of the element in masks.elements, and pads with random points up to
+// polynomialsize points
+template <typename ValueOf>
+void InterpolatePaddedWithDummies(std::vector<uint64_t>::iterator polynomial_offset,
+                                  const BinnedElements &masks, std::size_t first_bin,
+                                  std::size_t nbins_in_megabin, std::size_t polynomialsize,
+                                  PsiAnalyticsContext &context, ValueOf value_of) {
+  std::uniform_int_distribution<std::uint64_t> dist(0,
+                                                    (1ull << context.maxbitlen) - 1);  // [0,2^61)
+  std::random_device urandom("/dev/urandom");
+  auto my_rand = [&urandom, &dist]() { return dist(urandom); };
+
+  std::vector<ZpMersenneLongElement> X(polynomialsize), Y(polynomialsize), coeff(polynomialsize);
+
+  auto i = 0ull;
+  for (auto bin = first_bin; bin < first_bin + nbins_in_megabin; ++bin) {
+    for (auto k = masks.offsets.at(bin); k < masks.offsets.at(bin + 1); ++k, ++i) {
+      X.at(i).elem = masks.elements[k] & __61_bit_mask;
+      Y.at(i).elem = X.at(i).elem ^ value_of(bin, k);
+    }
+  }
+  // generate dummy elements for polynomial interpolation
+  for (; i < polynomialsize; ++i) {
+    X.at(i).elem = my_rand();
+    Y.at(i).elem = my_rand();
+  }
+
+  Poly::interpolateMersenne(coeff, X, Y);
+
+  auto coefficient = coeff.begin();
+  for (auto i = 0ull; i < coeff.size(); ++i, ++polynomial_offset, ++coefficient) {
+    *polynomial_offset = (*coefficient).elem;
+  }
+}
+
+}  // namespace
+
 void InterpolatePolynomials(std::vector<uint64_t> &polynomials,
-                            std::vector<uint64_t> &content_of_bins,
-                            const std::vector<std::vector<uint64_t>> &masks,
-                            PsiAnalyticsContext &context) {
-  std::size_t nbins = masks.size();
+                            std::vector<uint64_t> &content_of_bins, const BinnedElements &masks,
+                            PsiAnalyticsContext &context,
+                            const std::function<void(std::size_t)> &on_megabin_interpolated,
+                            const std::vector<uint64_t> &masked_payloads) {
+  std::size_t nbins = masks.GetNumOfBins() - context.nstashbins;
   std::size_t masks_offset = 0;
   std::size_t nbinsinmegabin = ceil_divide(nbins, context.nmegabins);
+  const std::size_t npolynomials = masked_payloads.empty() ? 1 : 2;
 
   for (auto mega_bin_i = 0ull; mega_bin_i < context.nmegabins; ++mega_bin_i) {
-    auto polynomial = polynomials.begin() + context.polynomialsize * mega_bin_i;
+    auto polynomial = polynomials.begin() + context.polynomialsize * npolynomials * mega_bin_i;
     auto bin = content_of_bins.begin() + nbinsinmegabin * mega_bin_i;
-    auto masks_in_bin = masks.begin() + nbinsinmegabin * mega_bin_i;
+    const auto first_bin = ceil_divide(nbins, context.nmegabins) * mega_bin_i;
 
-    if ((masks_offset + nbinsinmegabin) > masks.size()) {
-      auto overflow = (masks_offset + nbinsinmegabin) % masks.size();
+    if ((masks_offset + nbinsinmegabin) > nbins) {
+      auto overflow = (masks_offset + nbinsinmegabin) % nbins;
       nbinsinmegabin -= overflow;
     }
 
-    InterpolatePolynomialsPaddedWithDummies(polynomial, bin, masks_in_bin, nbinsinmegabin, context);
+    TraceRecorder::Scope interpolation(context.metrics.GetTrace(),
+                                       "interpolate mega bin " + std::to_string(mega_bin_i),
+                                       "opprf");
+    InterpolatePolynomialsPaddedWithDummies(polynomial, bin, masks, first_bin, nbinsinmegabin,
+                                            context);
+    if (!masked_payloads.empty()) {
+      InterpolatePolynomialsPaddedWithDummies(polynomial + context.polynomialsize, masked_payloads,
+                                              masks, first_bin, nbinsinmegabin, context);
+    }
     masks_offset += nbinsinmegabin;
-  }
-
-  assert(masks_offset == masks.size());
-}
 
-void InterpolatePolynomialsPaddedWithDummies(
-    std::vector<uint64_t>::iterator polynomial_offset,
-    std::vector<uint64_t>::const_iterator random_value_in_bin,
-    std::vector<std::vector<uint64_t>>::const_iterator masks_for_elems_in_bin,
-    std::size_t nbins_in_megabin, PsiAnalyticsContext &context) {
-  std::uniform_int_distribution<std::uint64_t> dist(0,
-                                                    (1ull << context.maxbitlen) - 1);  // [0,2^61)
-  std::random_device urandom("/dev/urandom");
-  auto my_rand = [&urandom, &dist]() { return dist(urandom); };
+    if (on_megabin_interpolated) {
+      on_megabin_interpolated(mega_bin_i);
+    }
+  }
 
-  std::vector<ZpMersenneLongElement> X(context.polynomialsize), Y(context.polynomialsize),
-      coeff(context.polynomialsize);
+  assert(masks_offset == nbins);
+
+  // the buckets of the stash bins follow the mega bins, see NumOfStashBuckets
+  const auto nstashbuckets = NumOfStashBuckets(context);
+  auto polynomial = polynomials.begin() + context.polynomialsize * npolynomials * context.nmegabins;
+  for (auto bin = nbins; bin < masks.GetNumOfBins(); ++bin) {
+    // sort the points of the bin by their bucket
+    std::vector<std::size_t> bucket_of_point;
+    BinnedElements bucket_masks;
+    bucket_masks.offsets.assign(nstashbuckets + 1, 0);
+    for (auto k = masks.offsets.at(bin); k < masks.offsets.at(bin + 1); ++k) {
+      bucket_of_point.push_back(BucketOf(masks.elements[k] & __61_bit_mask, nstashbuckets));
+      ++bucket_masks.offsets.at(bucket_of_point.back() + 1);
+    }
+    for (auto bucket = 0ull; bucket < nstashbuckets; ++bucket) {
+      bucket_masks.offsets.at(bucket + 1) += bucket_masks.offsets.at(bucket);
+    }
+    auto positions = bucket_masks.offsets;
+    bucket_masks.elements.resize(masks.GetBinSize(bin));
+    std::vector<uint64_t> bucket_values(masked_payloads.empty() ? 0 : masks.GetBinSize(bin));
+    for (auto i = 0ull; i < bucket_of_point.size(); ++i) {
+      const auto position = positions.at(bucket_of_point.at(i))++;
+      const auto k = masks.offsets.at(bin) + i;
+      bucket_masks.elements.at(position) = masks.elements[k];
+      if (!masked_payloads.empty()) {
+        bucket_values.at(position) = masked_payloads.at(k);
+      }
+    }
 
-  for (auto i = 0ull, bin_counter = 0ull; i < context.polynomialsize;) {
-    if (bin_counter < nbins_in_megabin) {
-      if ((*masks_for_elems_in_bin).size() > 0) {
-        for (auto &mask : *masks_for_elems_in_bin) {
-          X.at(i).elem = mask & __61_bit_mask;
-          Y.at(i).elem = X.at(i).elem ^ *random_value_in_bin;
-          ++i;
-        }
+    for (auto bucket = 0ull; bucket < nstashbuckets; ++bucket) {
+      if (bucket_masks.GetBinSize(bucket) > context.polynomialsize) {
+        throw std::runtime_error("A bucket of a stash bin exceeds the polynomial size");
+      }
+      InterpolatePaddedWithDummies(
+          polynomial, bucket_masks, bucket, 1, context.polynomialsize, context,
+          [&](std::size_t, std::size_t) { return content_of_bins.at(bin); });
+      polynomial += context.polynomialsize;
+      if (!masked_payloads.empty()) {
+        InterpolatePaddedWithDummies(
+            polynomial, bucket_masks, bucket, 1, context.polynomialsize, context,
+            [&](std::size_t, std::size_t k) { return bucket_values.at(k); });
+        polynomial += context.polynomialsize;
       }
-      ++masks_for_elems_in_bin;
-      ++random_value_in_bin;  // proceed to the next bin (iterator)
-      ++bin_counter;
-    } else {  // generate dummy elements for polynomial interpolation
-      X.at(i).elem = my_rand();
-      Y.at(i).elem = my_rand();
-      ++i;
     }
   }
+}
 
-  Poly::interpolateMersenne(coeff, X, Y);
+void InterpolatePolynomialsPaddedWithDummies(
+    std::vector<uint64_t>::iterator polynomial_offset,
+    std::vector<uint64_t>::const_iterator random_value_in_bin, const BinnedElements &masks,
+    std::size_t first_bin, std::size_t nbins_in_megabin, PsiAnalyticsContext &context) {
+  InterpolatePaddedWithDummies(
+      polynomial_offset, masks, first_bin, nbins_in_megabin, context.polynomialsize, context,
+      [&](std::size_t bin, std::size_t) { return *(random_value_in_bin + (bin - first_bin)); });
+}
 
-  auto coefficient = coeff.begin();
-  for (auto i = 0ull; i < coeff.size(); ++i, ++polynomial_offset, ++coefficient) {
-    *polynomial_offset = (*coefficient).elem;
-  }
+void InterpolatePolynomialsPaddedWithDummies(std::vector<uint64_t>::iterator polynomial_offset,
+                                             const std::vector<uint64_t> &masked_payloads,
+                                             const BinnedElements &masks, std::size_t first_bin,
+                                             std::size_t nbins_in_megabin,
+                                             PsiAnalyticsContext &context) {
+  InterpolatePaddedWithDummies(polynomial_offset, masks, first_bin, nbins_in_megabin,
+                               context.polynomialsize, context,
+                               [&](std::size_t, std::size_t k) { return masked_payloads.at(k); });
 }
 
 std::unique_ptr<CSocket> EstablishConnection(const std::string &address, uint16_t port,
@@ -382,14 +1097,30 @@ std::size_t PlainIntersectionSize(std::vector<std::uint64_t> v1, std::vector<std
   return intersection_v.size();
 }
 
+uint64_t PlainIntersectionPayloadSum(const std::vector<std::uint64_t> &client_elements,
+                                     const std::vector<std::uint64_t> &server_elements,
+                                     const std::vector<std::uint64_t> &server_payloads) {
+  std::unordered_set<std::uint64_t> client_set(client_elements.begin(), client_elements.end());
+  uint64_t sum = 0;
+  for (auto i = 0ull; i < server_elements.size(); ++i) {
+    if (client_set.count(server_elements.at(i)) > 0) {
+      sum += server_payloads.at(i);
+    }
+  }
+  return sum;
+}
+
 void PrintTimings(const PsiAnalyticsContext &context) {
   std::cout << "Time for hashing " << context.timings.hashing << " ms\n";
   std::cout << "Time for OPRF " << context.timings.oprf << " ms\n";
   std::cout << "Time for polynomials " << context.timings.polynomials << " ms\n";
   std::cout << "Time for transmission of the polynomials "
             << context.timings.polynomials_transmission << " ms\n";
-//  std::cout << "Time for OPPRF " << context.timings.opprf << " ms\n";
+  std::cout << "Time for OPPRF " << context.timings.opprf << " ms\n";
 
+  std::cout << "Time for building the circuit " << context.timings.circuit_construction << " ms\n";
+  std::cout << "Time for the ABY preparation " << context.timings.aby_preparation << " ms, "
+            << context.timings.aby_preparation_hidden << " ms of it hidden behind the OPPRF\n";
   std::cout << "ABY timings: online time " << context.timings.aby_online << " ms, setup time "
             << context.timings.aby_setup << " ms, total time " << context.timings.aby_total
             << " ms\n";
@@ -401,4 +1132,81 @@ void PrintTimings(const PsiAnalyticsContext &context) {
             << "ms\n";
 }
 
+std::vector<std::pair<std::string, double>> GetTimings(const PsiAnalyticsContext &context) {
+  const auto &timings = context.timings;
+  return {{"connection", timings.connection},
+          {"hashing", timings.hashing},
+          {"base_ots_aby", timings.base_ots_aby},
+          {"base_ots_libote", timings.base_ots_libote},
+          {"oprf", timings.oprf},
+          {"opprf", timings.opprf},
+          {"polynomials", timings.polynomials},
+          {"polynomials_transmission", timings.polynomials_transmission},
+          {"circuit_construction", timings.circuit_construction},
+          {"aby_preparation", timings.aby_preparation},
+          {"aby_preparation_hidden", timings.aby_preparation_hidden},
+          {"aby_setup", timings.aby_setup},
+          {"aby_online", timings.aby_online},
+          {"aby_total", timings.aby_total},
+          {"total", timings.total}};
+}
+
+void PrintCommunication(const PsiAnalyticsContext &context) {
+  for (const auto &phase : GetCommunication(context)) {
+    std::cout << "Communication for " << phase.first << ": sent " << phase.second.sent_bytes
+              << " bytes in " << phase.second.sent_messages << " messages, received "
+              << phase.second.received_bytes << " bytes in " << phase.second.received_messages
+              << " messages\n";
+  }
+}
+
+std::vector<std::pair<std::string, PsiAnalyticsContext::Communication>> GetCommunication(
+    const PsiAnalyticsContext &context) {
+  const auto &communication = context.communication;
+  return {{"base_ots_aby", communication.base_ots_aby},
+          {"base_ots_libote", communication.base_ots_libote},
+          {"oprf", communication.oprf},
+          {"polynomials", communication.polynomials},
+          {"aby_setup", communication.aby_setup},
+          {"aby_online", communication.aby_online}};
+}
+
+std::string GetMetricsJson(const PsiAnalyticsContext &context) {
+  std::ostringstream json;
+  json << std::setprecision(6) << std::fixed;
+  json << "{\"role\": \"" << (context.role == SERVER ? "server" : "client")
+       << "\", \"neles\": " << context.neles
+       << ", \"notherpartyselems\": " << context.notherpartyselems
+       << ", \"nbins\": " << context.nbins << ", \"nmegabins\": " << context.nmegabins
+       << ", \"polynomialsize\": " << context.polynomialsize
+       << ", \"nthreads\": " << context.nthreads << ", \"nshards\": " << context.nshards
+       << ", \"analytics_type\": " << context.analytics_type
+       << ", \"phases_ms\": " << context.metrics.ToJson() << ", \"communication\": {";
+  const auto communication = GetCommunication(context);
+  for (auto i = 0ull; i < communication.size(); ++i) {
+    const auto &counters = communication.at(i).second;
+    json << (i == 0 ? "" : ", ") << '"' << communication.at(i).first
+         << "\": {\"sent_bytes\": " << counters.sent_bytes
+         << ", \"received_bytes\": " << counters.received_bytes
+         << ", \"sent_messages\": " << counters.sent_messages
+         << ", \"received_messages\": " << counters.received_messages << '}';
+  }
+  json << "}, \"outputs\": [";
+  for (auto i = 0ull; i < context.outputs.size(); ++i) {
+    json << (i == 0 ? "" : ", ") << context.outputs.at(i);
+  }
+  json << "]}";
+  return json.str();
+}
+
+void PrintMemoryUsage(const PsiAnalyticsContext &context) {
+  for (const auto &phase : context.metrics.GetMemoryUsages()) {
+    const auto &usage = phase.second;
+    std::cout << "Memory for " << phase.first << ": " << usage.allocations << " allocations of "
+              << usage.allocated_bytes << " bytes, heap " << usage.heap_bytes << " bytes (peak "
+              << usage.heap_peak_bytes << " bytes), RSS " << usage.rss_bytes
+              << " bytes (peak increased by " << usage.rss_hwm_increase_bytes << " bytes)\n";
+  }
+}
+
 }
@@ -24,36 +24,114 @@
 
 #include "abycore/aby/abyparty.h"
 #include "abycore/circuit/share.h"
+#include "analytics_circuit.h"
+#include "binned_elements.h"
 #include "helpers.h"
+#include "match_shares.h"
+#include "native_analytics.h"
 #include "psi_analytics_context.h"
 
+#include <functional>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace ENCRYPTO {
 
 uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs, PsiAnalyticsContext &context);
 
+// for PAYLOAD_SUM, the server passes one payload per input element, for GROUPED_SUM one category
+// in [0, ncategories) per input element; the client passes none
+uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs,
+                           const std::vector<std::uint64_t> &payloads,
+                           PsiAnalyticsContext &context);
+
+// reuses the ABY party of the session, i.e., its connection and base OTs, across queries
+uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs, PsiAnalyticsContext &context,
+                           AnalyticsCircuitSession &session);
+
+uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs,
+                           const std::vector<std::uint64_t> &payloads,
+                           PsiAnalyticsContext &context, AnalyticsCircuitSession &session);
+
+// same as above on the native backend, see native_analytics.h
+uint64_t run_psi_analytics(const std::vector<std::uint64_t> &inputs,
+                           const std::vector<std::uint64_t> &payloads,
+                           PsiAnalyticsContext &context, NativeAnalyticsSession &session);
+
+// runs the PSI only up to the equality checks of the bins (analytics type MATCH_SHARES) and
+// returns this party's XOR shares of the match bits together with its bin-to-element mapping
+MatchShares run_psi_match_shares(const std::vector<std::uint64_t> &inputs,
+                                 PsiAnalyticsContext &context);
+
+MatchShares run_psi_match_shares(const std::vector<std::uint64_t> &inputs,
+                                 PsiAnalyticsContext &context, AnalyticsCircuitSession &session);
+
+MatchShares run_psi_match_shares(const std::vector<std::uint64_t> &inputs,
+                                 PsiAnalyticsContext &context, NativeAnalyticsSession &session);
+
+// if payload_bins is set, the server additionally programs the masked payloads into the OPPRF;
+// the client then gets payload ^ mask of each matched bin and the server the masks;
+// if match_shares is set, the elements of every bin are stored in it
 std::vector<uint64_t> OpprgPsiClient(const std::vector<uint64_t> &elements,
-                                     PsiAnalyticsContext &context);
+                                     PsiAnalyticsContext &context,
+                                     std::vector<uint64_t> *payload_bins = nullptr,
+                                     MatchShares *match_shares = nullptr);
 
 std::vector<uint64_t> OpprgPsiServer(const std::vector<uint64_t> &elements,
-                                     PsiAnalyticsContext &context);
+                                     PsiAnalyticsContext &context,
+                                     const std::vector<uint64_t> &payloads = {},
+                                     std::vector<uint64_t> *payload_bins = nullptr,
+                                     MatchShares *match_shares = nullptr);
 
+// masked_payloads, if any, holds one value per element of masks, i.e., in the same layout
 void InterpolatePolynomials(std::vector<uint64_t> &polynomials,
-                            std::vector<uint64_t> &content_of_bins,
-                            const std::vector<std::vector<uint64_t>> &masks,
-                            PsiAnalyticsContext &context);
+                            std::vector<uint64_t> &content_of_bins, const BinnedElements &masks,
+                            PsiAnalyticsContext &context,
+                            const std::function<void(std::size_t)> &on_megabin_interpolated = {},
+                            const std::vector<uint64_t> &masked_payloads = {});
 
+// interpolates the polynomial of the mega bin with the bins [first_bin, first_bin +
+// nbins_in_megabin) of masks; random_value_in_bin points to the value of the first bin
 void InterpolatePolynomialsPaddedWithDummies(
     std::vector<uint64_t>::iterator polynomial_offset,
-    std::vector<uint64_t>::const_iterator random_value_in_bin,
-    std::vector<std::vector<uint64_t>>::const_iterator masks_for_elems_in_bin,
-    std::size_t nbins_in_megabin, PsiAnalyticsContext &context);
+    std::vector<uint64_t>::const_iterator random_value_in_bin, const BinnedElements &masks,
+    std::size_t first_bin, std::size_t nbins_in_megabin, PsiAnalyticsContext &context);
+
+// the same for the polynomial of the masked payloads, which are laid out like masks
+void InterpolatePolynomialsPaddedWithDummies(std::vector<uint64_t>::iterator polynomial_offset,
+                                             const std::vector<uint64_t> &masked_payloads,
+                                             const BinnedElements &masks, std::size_t first_bin,
+                                             std::size_t nbins_in_megabin,
+                                             PsiAnalyticsContext &context);
 
 std::unique_ptr<CSocket> EstablishConnection(const std::string &address, uint16_t port,
                                              e_role role);
 
 std::size_t PlainIntersectionSize(std::vector<std::uint64_t> v1, std::vector<std::uint64_t> v2);
 
+uint64_t PlainIntersectionPayloadSum(const std::vector<std::uint64_t> &client_elements,
+                                     const std::vector<std::uint64_t> &server_elements,
+                                     const std::vector<std::uint64_t> &server_payloads);
+
 void PrintTimings(const PsiAnalyticsContext &context);
+
+// the timings of the last run as (name, milliseconds) pairs, in the order of
+// PsiAnalyticsContext::timings
+std::vector<std::pair<std::string, double>> GetTimings(const PsiAnalyticsContext &context);
+
+// the bytes and messages of the last run; the message counts of libOTe and ABY are not known
+void PrintCommunication(const PsiAnalyticsContext &context);
+
+// the communication of the last run as (phase, counters) pairs, in the order of
+// PsiAnalyticsContext::communication
+std::vector<std::pair<std::string, PsiAnalyticsContext::Communication>> GetCommunication(
+    const PsiAnalyticsContext &context);
+
+// the parameters, the phase timings (see PsiAnalyticsContext::metrics), the communication and the
+// outputs of the last run as one JSON object
+std::string GetMetricsJson(const PsiAnalyticsContext &context);
+
+// the memory usage of the phases of the last run if context.metrics tracked it
+void PrintMemoryUsage(const PsiAnalyticsContext &context);
 }
\ No newline at end of file
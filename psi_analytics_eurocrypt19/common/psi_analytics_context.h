@@ -22,8 +22,17 @@
 // OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#include "metrics.h"
+
+#include <cinttypes>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace ENCRYPTO {
 
+class AsyncNetworkEngine;
+
 struct PsiAnalyticsContext {
   uint16_t port;
   uint32_t role;
@@ -44,24 +53,128 @@ struct PsiAnalyticsContext {
     NONE,                // only calculate the equality of the bin elements - used for benchmarking
     THRESHOLD,           // 1 if T > PSI, 0 otherwise
     SUM,                 // number of matched elements
-    SUM_IF_GT_THRESHOLD  // number of matched elements if T > PSI, 0 otherwise
+    SUM_IF_GT_THRESHOLD,  // number of matched elements if T > PSI, 0 otherwise
+    PAYLOAD_SUM,          // sum of the server's payloads of the matched elements
+    MATCH_SHARES,         // XOR shares of the per-bin match bits, see match_shares.h
+    GROUPED_SUM           // number of matched elements for each category of the server
   } analytics_type;
 
   const uint64_t maxbitlen = 61;
 
+  uint64_t payload_bitlen = 32;  //< bit length of the server's payloads, at most maxbitlen
+  uint64_t ncategories = 1;      //< number of categories for GROUPED_SUM, at most maxbitlen
+
+  // bit length of the values that are programmed into the OPPRF next to the membership, which
+  // is one bit per category for GROUPED_SUM
+  uint64_t GetPayloadBitlen() const {
+    return analytics_type == GROUPED_SUM ? ncategories : payload_bitlen;
+  }
+
+  // if set, THRESHOLD and SUM_IF_GT_THRESHOLD are evaluated for each of these thresholds instead
+  // of threshold; all of them share one computation of the sum
+  std::vector<uint64_t> thresholds;
+  bool output_sum = false;  //< additionally reveal the sum for THRESHOLD and SUM_IF_GT_THRESHOLD
+
+  // results of the last run: one per threshold followed by the sum if output_sum is set
+  std::vector<uint64_t> outputs;
+
+  // number of extra bins for the elements that the client's cuckoo hashing puts into the stash;
+  // the server fills each of them with all of its elements, so they cost O(neles) each, but allow
+  // for a smaller epsilon, see OpprgPsiClient
+  uint64_t nstashbins = 0;
+
+  // number of shards that the element space is split into, see ShardOf in parallel_hashing.h;
+  // the shards are hashed, OPPRF'ed and compared one after the other with tables, polynomials and
+  // circuits sized for ShardCapacity elements, so the memory shrinks by this factor. The per-shard
+  // aggregates stay secret shared until the analytics function is applied to their sum, hence the
+  // outputs are the same as in a single run. nmegabins counts the mega bins of all shards, and
+  // polynomialsize is chosen for them; the shards rescale it to their capacity
+  uint64_t nshards = 1;
+
+  // sharings used for comparing the bins and for counting the matches; the number of matches is
+  // compared with the thresholds in the sharing of the equality checks, i.e., the arithmetic
+  // types convert it back to GMW or Yao
+  enum {
+    GMW_ARITHMETIC,  // GMW equality checks, matches counted in arithmetic sharing
+    GMW,             // only GMW, i.e., a Boolean Hamming weight circuit
+    YAO,             // only Yao, i.e., a constant number of rounds for high-latency networks
+    YAO_ARITHMETIC   // Yao equality checks, matches counted in arithmetic sharing
+  } circuit_type = GMW_ARITHMETIC;
+
+  // ABY evaluates the generic circuit above; NATIVE runs a dedicated OT-based protocol for the
+  // equality checks and the count instead, see native_analytics.h (not for the payload types)
+  enum { ABY, NATIVE } analytics_backend = ABY;
+
+  // if set, the handshake, the planned parameters and the polynomials of the OPPRF run on this
+  // (possibly shared) event-driven network engine instead of blocking sockets, and libOTe uses
+  // its IOService, see network/async_network_engine.h
+  std::shared_ptr<AsyncNetworkEngine> network_engine;
+
+  // the socket of the current run on network_engine, which the handshake opens and the OPPRF of
+  // every shard reuses; OpprgPsiClient and OpprgPsiServer open their own one if it is -1
+  int network_fd = -1;
+
+  // the aby_* fields and base_ots_aby time the analytics phase of either backend: with the NATIVE
+  // backend, aby_preparation and base_ots_aby are its base OTs, aby_setup its OT extension and
+  // aby_online the table lookups; the names are kept as they are the keys exported by GetTimings
   struct {
+    double connection;  //< establishing the connection before the run
     double hashing;
     double base_ots_aby;
     double base_ots_libote;
     double oprf;
-    double opprf;
+    double opprf;  //< hashing, OPRF and polynomials
     double polynomials;
     double polynomials_transmission;
+    double circuit_construction;
+    double aby_preparation;
+    double aby_preparation_hidden;
     double aby_setup;
     double aby_online;
     double aby_total;
     double total;
   } timings;
+
+  // bytes and messages of one phase; libOTe and ABY only count bytes, so the message counts
+  // cover the polynomials, which are sent by this code
+  struct Communication {
+    uint64_t sent_bytes = 0;
+    uint64_t received_bytes = 0;
+    uint64_t sent_messages = 0;
+    uint64_t received_messages = 0;
+
+    Communication &operator+=(const Communication &other) {
+      sent_bytes += other.sent_bytes;
+      received_bytes += other.received_bytes;
+      sent_messages += other.sent_messages;
+      received_messages += other.received_messages;
+      return *this;
+    }
+
+    // the communication between two snapshots of the counters of a channel
+    Communication operator-(const Communication &earlier) const {
+      Communication difference(*this);
+      difference.sent_bytes -= earlier.sent_bytes;
+      difference.received_bytes -= earlier.received_bytes;
+      difference.sent_messages -= earlier.sent_messages;
+      difference.received_messages -= earlier.received_messages;
+      return difference;
+    }
+  };
+
+  // communication of the last run per phase, the counterpart of timings
+  struct {
+    Communication base_ots_aby;  //< base OTs of ABY or of the native backend, first query only
+    Communication base_ots_libote;
+    Communication oprf;
+    Communication polynomials;
+    Communication aby_setup;  //< the OT extension of the native backend
+    Communication aby_online;
+  } communication;
+
+  // the hierarchical phase timings of the last run on the monotonic clock, see metrics.h; the
+  // fields of timings are filled from the same timers
+  MetricsRegistry metrics;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "trace.h"
+
+#include <iomanip>
+#include <sstream>
+
+namespace ENCRYPTO {
+
+namespace {
+
+using duration_micros = std::chrono::duration<double, std::micro>;
+
+}  // namespace
+
+TraceRecorder::Scope::Scope(TraceRecorder *recorder, std::string name, const char *category)
+    : recorder_(recorder), name_(std::move(name)), category_(category) {
+  if (recorder_) {
+    recorder_->Begin(name_, category_);
+  }
+}
+
+TraceRecorder::Scope::Scope(Scope &&other) noexcept
+    : recorder_(other.recorder_), name_(std::move(other.name_)), category_(other.category_) {
+  other.recorder_ = nullptr;
+}
+
+TraceRecorder::Scope::~Scope() {
+  if (recorder_) {
+    recorder_->End(name_, category_);
+  }
+}
+
+TraceRecorder::TraceRecorder(uint32_t pid, std::string name) : pid_(pid), name_(std::move(name)) {}
+
+double TraceRecorder::Now() {
+  return duration_micros(Clock::now().time_since_epoch()).count();
+}
+
+void TraceRecorder::Begin(const std::string &name, const char *category) {
+  Emit({name, category, 'B', Now(), 0, 0});
+}
+
+void TraceRecorder::End(const std::string &name, const char *category) {
+  Emit({name, category, 'E', Now(), 0, 0});
+}
+
+void TraceRecorder::Complete(const std::string &name, const char *category,
+                             Clock::time_point start, Clock::time_point end) {
+  Emit({name, category, 'X', duration_micros(start.time_since_epoch()).count(),
+        duration_micros(end - start).count(), 0});
+}
+
+void TraceRecorder::Emit(Event event) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  event.tid = tids_.emplace(std::this_thread::get_id(), tids_.size()).first->second;
+  events_.push_back(std::move(event));
+}
+
+std::size_t TraceRecorder::GetNumOfEvents() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return events_.size();
+}
+
+void TraceRecorder::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.clear();
+}
+
+std::string TraceRecorder::ToJson() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream json;
+  json << std::setprecision(3) << std::fixed;
+  json << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  json << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid_
+       << ", \"tid\": 0, \"args\": {\"name\": \"" << name_ << "\"}}";
+  for (const auto &event : events_) {
+    json << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category
+         << "\", \"ph\": \"" << event.phase << "\", \"ts\": " << event.timestamp_us + offset_us_;
+    if (event.phase == 'X') {
+      json << ", \"dur\": " << event.duration_us;
+    }
+    json << ", \"pid\": " << pid_ << ", \"tid\": " << event.tid << '}';
+  }
+  json << "\n]}\n";
+  return json.str();
+}
+
+}
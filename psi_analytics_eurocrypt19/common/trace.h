@@ -0,0 +1,107 @@
+#pragma once
+//
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <chrono>
+#include <cinttypes>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ENCRYPTO {
+
+// Buffer of the trace events of one party in the Chrome trace event format, which chrome://tracing
+// and Perfetto display as a timeline. The phase timers of MetricsRegistry emit begin and end events
+// if it has a recorder, finer steps like the mega bins are emitted with Scope. The parties' traces
+// are aligned by a clock offset that is estimated when they connect, see SynchronizeClocks in
+// psi_analytics.cpp, and can be merged into one timeline with
+//   jq -s '{traceEvents: map(.traceEvents) | add}' client.json server.json
+class TraceRecorder {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // emits a begin event on construction and the matching end event on destruction; does nothing
+  // if recorder is nullptr, i.e., if tracing is disabled
+  class Scope {
+   public:
+    Scope(TraceRecorder *recorder, std::string name, const char *category);
+    Scope(Scope &&other) noexcept;
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope();
+
+   private:
+    TraceRecorder *recorder_;
+    std::string name_;
+    const char *category_;
+  };
+
+  // pid tells the parties apart in a merged trace, name labels it
+  TraceRecorder(uint32_t pid, std::string name);
+
+  // microseconds on the local monotonic clock
+  static double Now();
+
+  void Begin(const std::string &name, const char *category);
+  void End(const std::string &name, const char *category);
+
+  // an event that was measured elsewhere, e.g., the phases of ABY
+  void Complete(const std::string &name, const char *category, Clock::time_point start,
+                Clock::time_point end);
+
+  // added to all timestamps of this party when serializing, in microseconds
+  void SetClockOffset(double offset_us) { offset_us_ = offset_us; }
+  double GetClockOffset() const { return offset_us_; }
+
+  std::size_t GetNumOfEvents() const;
+
+  void Clear();
+
+  // {"traceEvents": [...]} with one event per line
+  std::string ToJson() const;
+
+ private:
+  struct Event {
+    std::string name;
+    const char *category;
+    char phase;  //< 'B'egin, 'E'nd or 'X' for complete events
+    double timestamp_us;
+    double duration_us;
+    uint32_t tid;
+  };
+
+  void Emit(Event event);
+
+  uint32_t pid_;
+  std::string name_;
+  double offset_us_ = 0;
+
+  mutable std::mutex mutex_;
+  std::vector<Event> events_;
+  // small thread ids for the timeline in the order in which the threads emitted their first event
+  std::unordered_map<std::thread::id, uint32_t> tids_;
+};
+
+}
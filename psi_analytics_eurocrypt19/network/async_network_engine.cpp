@@ -0,0 +1,478 @@
+//
+// \file async_network_engine.cpp
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "async_network_engine.h"
+
+#include "cryptoTools/Network/IOService.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace ENCRYPTO {
+
+namespace {
+
+constexpr int MAX_EVENTS = 64;
+constexpr std::size_t CONNECT_RETRIES = 1000;
+constexpr auto CONNECT_RETRY_INTERVAL = std::chrono::milliseconds(10);
+
+std::runtime_error SocketError(const std::string &what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+void SetNonBlocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    throw SocketError("Could not make socket non-blocking");
+  }
+}
+
+void SetNoDelay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+sockaddr_in ToSocketAddress(const std::string &address, uint16_t port) {
+  sockaddr_in socket_address;
+  std::memset(&socket_address, 0, sizeof(socket_address));
+  socket_address.sin_family = AF_INET;
+  socket_address.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &socket_address.sin_addr) != 1) {
+    throw std::runtime_error("Invalid IPv4 address " + address);
+  }
+  return socket_address;
+}
+
+int CreateListeningSocket(const std::string &address, uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw SocketError("Could not create socket");
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  auto socket_address = ToSocketAddress(address, port);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&socket_address), sizeof(socket_address)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    auto error = SocketError("Could not listen on " + address + ":" + std::to_string(port));
+    close(fd);
+    throw error;
+  }
+  return fd;
+}
+
+bool WouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+}
+
+AsyncNetworkEngine::AsyncNetworkEngine(std::size_t nthreads) : running_(true) {
+  nthreads = std::max<std::size_t>(nthreads, 1);
+  io_service_ = std::make_unique<osuCrypto::IOService>(nthreads);
+  for (auto i = 0ull; i < nthreads; ++i) {
+    auto worker = std::make_unique<Worker>();
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    worker->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->epoll_fd < 0 || worker->wakeup_fd < 0) {
+      throw SocketError("Could not initialize the network engine");
+    }
+
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = worker->wakeup_fd;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup_fd, &event) < 0) {
+      throw SocketError("Could not initialize the network engine");
+    }
+    workers_.push_back(std::move(worker));
+  }
+
+  for (auto &worker : workers_) {
+    Worker *w = worker.get();
+    w->thread = std::thread([this, w]() { Run(*w); });
+  }
+}
+
+AsyncNetworkEngine::~AsyncNetworkEngine() { Stop(); }
+
+int AsyncNetworkEngine::Listen(const std::string &address, uint16_t port,
+                               AcceptHandler on_accept) {
+  return StartListening(address, port, std::move(on_accept), false);
+}
+
+void AsyncNetworkEngine::AsyncAccept(const std::string &address, uint16_t port,
+                                     AcceptHandler on_accept) {
+  StartListening(address, port, std::move(on_accept), true);
+}
+
+int AsyncNetworkEngine::Accept(const std::string &address, uint16_t port) {
+  auto promise = std::make_shared<std::promise<int>>();
+  auto accepted = promise->get_future();
+  AsyncAccept(address, port, [promise](int fd) { promise->set_value(fd); });
+  const int fd = accepted.get();
+  if (fd < 0) {
+    throw std::runtime_error("The network engine stopped before accepting a connection");
+  }
+  return fd;
+}
+
+int AsyncNetworkEngine::Connect(const std::string &address, uint16_t port) {
+  auto socket_address = ToSocketAddress(address, port);
+
+  // the other party might not be listening yet
+  for (auto retry = 0ull; retry < CONNECT_RETRIES; ++retry) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      throw SocketError("Could not create socket");
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&socket_address), sizeof(socket_address)) == 0) {
+      SetNonBlocking(fd);
+      SetNoDelay(fd);
+      return fd;
+    }
+    close(fd);
+    std::this_thread::sleep_for(CONNECT_RETRY_INTERVAL);
+  }
+
+  throw SocketError("Could not connect to " + address + ":" + std::to_string(port));
+}
+
+void AsyncNetworkEngine::AsyncSend(int fd, const void *data, std::size_t size,
+                                   Completion on_done) {
+  if (size == 0) {
+    on_done(true);
+    return;
+  }
+  // the buffer is only read from, the const_cast is to share the Operation type with receives
+  Operation operation{const_cast<std::uint8_t *>(reinterpret_cast<const std::uint8_t *>(data)),
+                      size, 0, std::move(on_done)};
+  auto &worker = WorkerOf(fd);
+  Post(worker, [this, &worker, fd, operation]() mutable {
+    auto &connection = Register(worker, fd);
+    if (connection.failed) {
+      operation.on_done(false);
+      return;
+    }
+    connection.sends.push_back(std::move(operation));
+    HandleEvents(worker, fd, EPOLLOUT);
+  });
+}
+
+void AsyncNetworkEngine::AsyncReceive(int fd, void *data, std::size_t size, Completion on_done) {
+  if (size == 0) {
+    on_done(true);
+    return;
+  }
+  Operation operation{reinterpret_cast<std::uint8_t *>(data), size, 0, std::move(on_done)};
+  auto &worker = WorkerOf(fd);
+  Post(worker, [this, &worker, fd, operation]() mutable {
+    auto &connection = Register(worker, fd);
+    if (connection.failed) {
+      operation.on_done(false);
+      return;
+    }
+    connection.receives.push_back(std::move(operation));
+    HandleEvents(worker, fd, EPOLLIN);
+  });
+}
+
+std::future<bool> AsyncNetworkEngine::Send(int fd, const void *data, std::size_t size) {
+  auto promise = std::make_shared<std::promise<bool>>();
+  auto future = promise->get_future();
+  AsyncSend(fd, data, size, [promise](bool success) { promise->set_value(success); });
+  return future;
+}
+
+std::future<bool> AsyncNetworkEngine::Receive(int fd, void *data, std::size_t size) {
+  auto promise = std::make_shared<std::promise<bool>>();
+  auto future = promise->get_future();
+  AsyncReceive(fd, data, size, [promise](bool success) { promise->set_value(success); });
+  return future;
+}
+
+void AsyncNetworkEngine::Close(int fd) {
+  auto &worker = WorkerOf(fd);
+  Post(worker, [this, &worker, fd]() {
+    if (worker.connections.count(fd) > 0) {
+      FailAndRemove(worker, fd);
+    } else {
+      close(fd);
+    }
+  });
+}
+
+void AsyncNetworkEngine::Stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+
+  for (auto &worker : workers_) {
+    const std::uint64_t one = 1;
+    if (write(worker->wakeup_fd, &one, sizeof(one)) < 0) {
+      // the worker is woken up by the pending counter in any case
+    }
+  }
+
+  for (auto &worker : workers_) {
+    if (worker->thread.joinable()) {
+      worker->thread.join();
+    }
+    close(worker->wakeup_fd);
+    close(worker->epoll_fd);
+  }
+}
+
+int AsyncNetworkEngine::StartListening(const std::string &address, uint16_t port,
+                                       AcceptHandler on_accept, bool accept_once) {
+  const int fd = CreateListeningSocket(address, port);
+  SetNonBlocking(fd);
+  auto &worker = WorkerOf(fd);
+  Post(worker, [this, &worker, fd, on_accept, accept_once]() {
+    auto &connection = Register(worker, fd);
+    connection.on_accept = on_accept;
+    connection.accept_once = accept_once;
+    UpdateInterest(worker, fd, connection);
+  });
+  return fd;
+}
+
+void AsyncNetworkEngine::Post(Worker &worker, std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+  }
+  const std::uint64_t one = 1;
+  if (write(worker.wakeup_fd, &one, sizeof(one)) < 0 && !WouldBlock()) {
+    throw SocketError("Could not wake up the network engine");
+  }
+}
+
+void AsyncNetworkEngine::Run(Worker &worker) {
+  std::array<epoll_event, MAX_EVENTS> events;
+
+  const auto run_tasks = [&worker]() {
+    std::uint64_t counter;
+    while (read(worker.wakeup_fd, &counter, sizeof(counter)) > 0) {
+    }
+    std::vector<std::function<void()>> tasks;
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      tasks.swap(worker.tasks);
+    }
+    for (auto &task : tasks) {
+      task();
+    }
+  };
+
+  while (running_) {
+    const int nevents = epoll_wait(worker.epoll_fd, events.data(), MAX_EVENTS, -1);
+    if (nevents < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    for (auto i = 0; i < nevents; ++i) {
+      if (events.at(i).data.fd == worker.wakeup_fd) {
+        run_tasks();
+      } else {
+        HandleEvents(worker, events.at(i).data.fd, events.at(i).events);
+      }
+    }
+  }
+
+  // register what was submitted before stopping and fail it, so that nobody waits forever
+  run_tasks();
+  while (!worker.connections.empty()) {
+    FailAndRemove(worker, worker.connections.begin()->first);
+  }
+}
+
+AsyncNetworkEngine::Connection &AsyncNetworkEngine::Register(Worker &worker, int fd) {
+  auto it = worker.connections.find(fd);
+  if (it != worker.connections.end()) {
+    return it->second;
+  }
+
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.data.fd = fd;
+  if (epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    throw SocketError("Could not register socket in the network engine");
+  }
+  return worker.connections[fd];
+}
+
+void AsyncNetworkEngine::UpdateInterest(Worker &worker, int fd, Connection &connection) {
+  std::uint32_t events = 0;
+  if (connection.on_accept || !connection.receives.empty()) {
+    events |= EPOLLIN;
+  }
+  if (!connection.sends.empty()) {
+    events |= EPOLLOUT;
+  }
+  if (events == connection.events) {
+    return;
+  }
+
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(worker.epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+    Fail(worker, fd, connection);
+    return;
+  }
+  connection.events = events;
+}
+
+void AsyncNetworkEngine::HandleEvents(Worker &worker, int fd, std::uint32_t events) {
+  auto it = worker.connections.find(fd);
+  if (it == worker.connections.end()) {
+    return;
+  }
+  auto &connection = it->second;
+  if (connection.failed) {
+    return;
+  }
+
+  if (connection.on_accept) {
+    int client_fd;
+    while ((client_fd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+      SetNoDelay(client_fd);
+      if (connection.accept_once) {
+        auto on_accept = std::move(connection.on_accept);
+        connection.on_accept = nullptr;
+        FailAndRemove(worker, fd);
+        on_accept(client_fd);
+        return;
+      }
+      connection.on_accept(client_fd);
+    }
+    return;
+  }
+
+  // epoll reports errors and hang-ups even without interest in the socket; a hang-up with pending
+  // operations is left to them, as buffered data can still be received
+  if ((events & EPOLLERR) || ((events & EPOLLHUP) && connection.events == 0)) {
+    Fail(worker, fd, connection);
+    return;
+  }
+
+  while (!connection.receives.empty()) {
+    auto &operation = connection.receives.front();
+    const auto nbytes = recv(fd, operation.data + operation.transferred,
+                             operation.size - operation.transferred, 0);
+    if (nbytes > 0) {
+      operation.transferred += static_cast<std::size_t>(nbytes);
+      if (operation.transferred == operation.size) {
+        auto on_done = std::move(operation.on_done);
+        connection.receives.pop_front();
+        on_done(true);
+      }
+    } else if (nbytes < 0 && errno == EINTR) {
+      continue;
+    } else if (nbytes < 0 && WouldBlock()) {
+      break;
+    } else {  // the connection was closed or broke
+      Fail(worker, fd, connection);
+      return;
+    }
+  }
+
+  while (!connection.sends.empty()) {
+    auto &operation = connection.sends.front();
+    const auto nbytes = send(fd, operation.data + operation.transferred,
+                             operation.size - operation.transferred, MSG_NOSIGNAL);
+    if (nbytes >= 0) {
+      operation.transferred += static_cast<std::size_t>(nbytes);
+      if (operation.transferred == operation.size) {
+        auto on_done = std::move(operation.on_done);
+        connection.sends.pop_front();
+        on_done(true);
+      }
+    } else if (errno == EINTR) {
+      continue;
+    } else if (WouldBlock()) {
+      break;
+    } else {
+      Fail(worker, fd, connection);
+      return;
+    }
+  }
+
+  UpdateInterest(worker, fd, connection);
+}
+
+void AsyncNetworkEngine::Fail(Worker &worker, int fd, Connection &connection) {
+  if (!connection.failed) {
+    epoll_ctl(worker.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    connection.failed = true;
+    connection.events = 0;
+  }
+
+  // nobody waits for the connections of a listening socket, except for AsyncAccept
+  if (connection.on_accept && connection.accept_once) {
+    auto on_accept = std::move(connection.on_accept);
+    connection.on_accept = nullptr;
+    on_accept(-1);
+  }
+
+  // the continuations may submit further operations, which fail right away
+  auto receives = std::move(connection.receives);
+  auto sends = std::move(connection.sends);
+  connection.receives.clear();
+  connection.sends.clear();
+  for (auto &operation : receives) {
+    operation.on_done(false);
+  }
+  for (auto &operation : sends) {
+    operation.on_done(false);
+  }
+}
+
+void AsyncNetworkEngine::FailAndRemove(Worker &worker, int fd) {
+  auto it = worker.connections.find(fd);
+  if (it == worker.connections.end()) {
+    return;
+  }
+  Fail(worker, fd, it->second);
+  worker.connections.erase(fd);
+  close(fd);
+}
+
+}
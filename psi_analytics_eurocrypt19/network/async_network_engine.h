@@ -0,0 +1,150 @@
+#pragma once
+
+//
+// \file async_network_engine.h
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the Software
+// is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+// A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <atomic>
+#include <cinttypes>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace osuCrypto {
+class IOService;
+}
+
+namespace ENCRYPTO {
+
+// Event-driven socket I/O shared by many concurrent protocol sessions.
+//
+// A small fixed set of I/O threads run one epoll loop each. Every socket is owned by exactly one
+// of them, so the per-socket state is never touched concurrently. Sends and receives are
+// submitted together with a continuation that is invoked on the I/O thread once the whole
+// buffer was transferred (or the connection failed). The caller has to keep the buffer alive
+// until then. Once a socket failed, its pending and all later operations fail until it is closed.
+//
+// A run on the engine accepts its connection on the base port through the listening sockets of
+// the engine, and the handshake with the clock synchronization, the planned parameters and the
+// polynomials of the OPPRF are continuations on that one socket. The libOTe sessions of the OPRF
+// and of the native backend share the IOService of the engine instead of starting one each.
+// What still blocks: the client's Connect, the calling thread of a run, which computes the
+// protocol and waits for the continuations, the OT extension of libOTe on that thread, and ABY
+// with sockets and threads of its own.
+class AsyncNetworkEngine {
+ public:
+  using Completion = std::function<void(bool success)>;
+  using AcceptHandler = std::function<void(int fd)>;
+
+  explicit AsyncNetworkEngine(std::size_t nthreads = 1);
+  ~AsyncNetworkEngine();
+
+  AsyncNetworkEngine(const AsyncNetworkEngine &) = delete;
+  AsyncNetworkEngine &operator=(const AsyncNetworkEngine &) = delete;
+
+  // listens on address:port and hands every accepted (non-blocking) socket to on_accept,
+  // which is called on an I/O thread; returns the listening socket
+  int Listen(const std::string &address, uint16_t port, AcceptHandler on_accept);
+
+  // like Listen, but stops listening after the first connection; on_accept gets -1 if the
+  // engine stops before
+  void AsyncAccept(const std::string &address, uint16_t port, AcceptHandler on_accept);
+
+  // blocking helpers for establishing a single session, the returned socket is non-blocking;
+  // Accept waits for AsyncAccept
+  int Accept(const std::string &address, uint16_t port);
+  int Connect(const std::string &address, uint16_t port);
+
+  void AsyncSend(int fd, const void *data, std::size_t size, Completion on_done);
+  void AsyncReceive(int fd, void *data, std::size_t size, Completion on_done);
+
+  std::future<bool> Send(int fd, const void *data, std::size_t size);
+  std::future<bool> Receive(int fd, void *data, std::size_t size);
+
+  // fails all pending operations on the socket and closes it
+  void Close(int fd);
+
+  void Stop();
+
+  std::size_t GetNumOfThreads() const { return workers_.size(); }
+
+  // shared by the libOTe sessions of all runs on the engine
+  osuCrypto::IOService &GetIOService() { return *io_service_; }
+
+ private:
+  struct Operation {
+    std::uint8_t *data;
+    std::size_t size;
+    std::size_t transferred;
+    Completion on_done;
+  };
+
+  struct Connection {
+    std::deque<Operation> sends, receives;
+    AcceptHandler on_accept;
+    bool accept_once = false;  //< see AsyncAccept
+    std::uint32_t events = 0;
+    bool failed = false;  //< the socket is no longer polled, see Fail
+  };
+
+  struct Worker {
+    int epoll_fd = -1;
+    int wakeup_fd = -1;
+    std::thread thread;
+    std::mutex mutex;
+    std::vector<std::function<void()>> tasks;  //< submitted from other threads
+    std::unordered_map<int, Connection> connections;  //< only accessed by the I/O thread
+  };
+
+  Worker &WorkerOf(int fd) { return *workers_.at(static_cast<std::size_t>(fd) % workers_.size()); }
+
+  int StartListening(const std::string &address, uint16_t port, AcceptHandler on_accept,
+                     bool accept_once);
+
+  void Post(Worker &worker, std::function<void()> task);
+
+  void Run(Worker &worker);
+
+  Connection &Register(Worker &worker, int fd);
+
+  void UpdateInterest(Worker &worker, int fd, Connection &connection);
+
+  void HandleEvents(Worker &worker, int fd, std::uint32_t events);
+
+  // fails the pending operations and stops polling the socket, which stays open until Close
+  void Fail(Worker &worker, int fd, Connection &connection);
+
+  void FailAndRemove(Worker &worker, int fd);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<bool> running_;
+  std::unique_ptr<osuCrypto::IOService> io_service_;
+};
+
+}
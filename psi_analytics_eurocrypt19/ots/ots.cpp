@@ -34,9 +34,9 @@
 
 #include "common/constants.h"
 #include "common/psi_analytics_context.h"
+#include "network/async_network_engine.h"
 
-using milliseconds_ratio = std::ratio<1, 1000>;
-using duration_millis = std::chrono::duration<double, milliseconds_ratio>;
+#include <memory>
 
 namespace ENCRYPTO {
 // Client
@@ -57,12 +57,17 @@ std::vector<std::uint64_t> ot_receiver(const std::vector<std::uint64_t> &inputs,
 
   // set up networking
   std::string name = "n";
-  osuCrypto::IOService ios;
-  osuCrypto::Session ep(ios, context.address, context.port + 1, osuCrypto::SessionMode::Client,
-                        name);
+  // the runs on a network engine share its IOService
+  std::unique_ptr<osuCrypto::IOService> own_ios;
+  if (!context.network_engine) {
+    own_ios = std::make_unique<osuCrypto::IOService>();
+  }
+  auto &ios = context.network_engine ? context.network_engine->GetIOService() : *own_ios;
+  osuCrypto::Session ep(ios, context.address, context.port + libote_port_offset,
+                        osuCrypto::SessionMode::Client, name);
   auto recvChl = ep.addChannel(name, name);
 
-  const auto baseots_start_time = std::chrono::system_clock::now();
+  auto baseots_timer = context.metrics.Time("opprf/oprf/base_ots");
   // the number of base OT that need to be done
   osuCrypto::u64 baseCount = recv.getBaseOTCount();
 
@@ -73,12 +78,16 @@ std::vector<std::uint64_t> ot_receiver(const std::vector<std::uint64_t> &inputs,
   osuCrypto::DefaultBaseOT baseOTs;
   baseOTs.send(baseSend, prng, recvChl, 1);
   recv.setBaseOts(baseSend);
-  const auto baseots_end_time = std::chrono::system_clock::now();
-  const duration_millis baseOTs_duration = baseots_end_time - baseots_start_time;
-  context.timings.base_ots_libote = baseOTs_duration.count();
-
-  const auto OPRF_start_time = std::chrono::system_clock::now();
-  recv.init(numOTs, prng, recvChl);
+  const auto baseots_communication = ChannelCommunication(recvChl);
+  context.communication.base_ots_libote = baseots_communication;
+  context.timings.base_ots_libote = baseots_timer.Stop();
+
+  auto OPRF_timer = context.metrics.Time("opprf/oprf/extension");
+  auto trace = context.metrics.GetTrace();
+  {
+    TraceRecorder::Scope init(trace, "KKRT init", "oprf");
+    recv.init(numOTs, prng, recvChl);
+  }
 
   std::vector<osuCrypto::block> blocks(numOTs), receiver_encoding(numOTs);
 
@@ -86,35 +95,43 @@ std::vector<std::uint64_t> ot_receiver(const std::vector<std::uint64_t> &inputs,
     blocks.at(i) = osuCrypto::toBlock(inputs[i]);
   }
 
-  for (auto k = 0ull; k < numOTs && k < inputs.size(); ++k) {
-    recv.encode(k, &blocks.at(k), reinterpret_cast<uint8_t *>(&receiver_encoding.at(k)),
-                sizeof(osuCrypto::block));
+  {
+    TraceRecorder::Scope encoding_scope(trace, "KKRT encode", "oprf");
+    for (auto k = 0ull; k < numOTs && k < inputs.size(); ++k) {
+      recv.encode(k, &blocks.at(k), reinterpret_cast<uint8_t *>(&receiver_encoding.at(k)),
+                  sizeof(osuCrypto::block));
+    }
   }
 
-  recv.sendCorrection(recvChl, numOTs);
+  {
+    TraceRecorder::Scope correction(trace, "KKRT send correction", "oprf");
+    recv.sendCorrection(recvChl, numOTs);
+  }
 
   for (auto k = 0ull; k < numOTs; ++k) {
     // copy only part of the encoding
     outputs.push_back(reinterpret_cast<uint64_t *>(&receiver_encoding.at(k))[0] &= __61_bit_mask);
   }
-  const auto OPRF_end_time = std::chrono::system_clock::now();
-  const duration_millis OPRF_duration = OPRF_end_time - OPRF_start_time;
-  context.timings.oprf = OPRF_duration.count();
+  context.timings.oprf = OPRF_timer.Stop();
+  context.communication.oprf = ChannelCommunication(recvChl) - baseots_communication;
 
   recvChl.close();
   ep.stop();
-  ios.stop();
+  if (own_ios) {
+    own_ios->stop();
+  }
 
   return outputs;
 }
 
 // Server
-std::vector<std::vector<std::uint64_t>> ot_sender(
-    const std::vector<std::vector<std::uint64_t>> &inputs, ENCRYPTO::PsiAnalyticsContext &context) {
-  std::size_t numOTs = inputs.size();
+BinnedElements ot_sender(const BinnedElements &inputs, ENCRYPTO::PsiAnalyticsContext &context) {
+  std::size_t numOTs = inputs.GetNumOfBins();
   osuCrypto::PRNG prng(_mm_set_epi32(4253465, 3434565, 234435, 23987025));
   osuCrypto::KkrtNcoOtSender sender;
-  std::vector<std::vector<std::uint64_t>> outputs(inputs.size());
+  BinnedElements outputs;
+  outputs.offsets = inputs.offsets;
+  outputs.elements.resize(inputs.elements.size());
 
   // get up the parameters and get some information back.
   //  1) false = semi-honest
@@ -123,12 +140,17 @@ std::vector<std::vector<std::uint64_t>> ot_sender(
   sender.configure(false, 40, 128);
 
   std::string name = "n";
-  osuCrypto::IOService ios;
-  osuCrypto::Session ep(ios, context.address, context.port + 1, osuCrypto::SessionMode::Server,
-                        name);
+  // the runs on a network engine share its IOService
+  std::unique_ptr<osuCrypto::IOService> own_ios;
+  if (!context.network_engine) {
+    own_ios = std::make_unique<osuCrypto::IOService>();
+  }
+  auto &ios = context.network_engine ? context.network_engine->GetIOService() : *own_ios;
+  osuCrypto::Session ep(ios, context.address, context.port + libote_port_offset,
+                        osuCrypto::SessionMode::Server, name);
   auto sendChl = ep.addChannel(name, name);
 
-  const auto baseots_start_time = std::chrono::system_clock::now();
+  auto baseots_timer = context.metrics.Time("opprf/oprf/base_ots");
 
   osuCrypto::u64 baseCount = sender.getBaseOTCount();
   osuCrypto::DefaultBaseOT baseOTs;
@@ -139,44 +161,51 @@ std::vector<std::vector<std::uint64_t>> ot_sender(
   baseOTs.receive(choices, baseRecv, prng, sendChl, 1);
 
   sender.setBaseOts(baseRecv, choices);
+  const auto baseots_communication = ChannelCommunication(sendChl);
+  context.communication.base_ots_libote = baseots_communication;
 
-  const auto baseots_end_time = std::chrono::system_clock::now();
-  const duration_millis baseOTs_duration = baseots_end_time - baseots_start_time;
-  context.timings.base_ots_libote = baseOTs_duration.count();
-
-  const auto OPRF_start_time = std::chrono::system_clock::now();
-  sender.init(numOTs, prng, sendChl);
+  context.timings.base_ots_libote = baseots_timer.Stop();
 
-  std::vector<std::vector<osuCrypto::block>> inputs_as_blocks(numOTs), outputs_as_blocks(numOTs);
-  for (auto i = 0ull; i < numOTs; ++i) {
-    outputs_as_blocks.at(i).resize(inputs.at(i).size());
-    for (auto &var : inputs.at(i)) {
-      inputs_as_blocks.at(i).push_back(osuCrypto::toBlock(var));
-    }
+  auto OPRF_timer = context.metrics.Time("opprf/oprf/extension");
+  auto trace = context.metrics.GetTrace();
+  {
+    TraceRecorder::Scope init(trace, "KKRT init", "oprf");
+    sender.init(numOTs, prng, sendChl);
   }
-  sender.recvCorrection(sendChl, numOTs);
 
-  for (auto i = 0ull; i < numOTs; ++i) {
-    for (auto j = 0ull; j < inputs_as_blocks.at(i).size(); ++j) {
-      sender.encode(i, &inputs_as_blocks.at(i).at(j), &outputs_as_blocks.at(i).at(j),
-                    sizeof(osuCrypto::block));
-    }
+  {
+    TraceRecorder::Scope correction(trace, "KKRT receive correction", "oprf");
+    sender.recvCorrection(sendChl, numOTs);
   }
 
-  for (auto i = 0ull; i < numOTs; ++i) {
-    for (auto &encoding : outputs_as_blocks.at(i)) {
-      outputs.at(i).push_back(reinterpret_cast<uint64_t *>(&encoding)[0] &= __61_bit_mask);
+  // the elements are encoded one by one from the contiguous bins, without a copy as blocks
+  {
+    TraceRecorder::Scope encoding_scope(trace, "KKRT encode", "oprf");
+    for (auto i = 0ull; i < numOTs; ++i) {
+      for (auto k = inputs.offsets[i]; k < inputs.offsets[i + 1]; ++k) {
+        osuCrypto::block input = osuCrypto::toBlock(inputs.elements[k]), encoding;
+        sender.encode(i, &input, &encoding, sizeof(osuCrypto::block));
+        outputs.elements[k] = reinterpret_cast<uint64_t *>(&encoding)[0] & __61_bit_mask;
+      }
     }
   }
 
-  const auto OPRF_end_time = std::chrono::system_clock::now();
-  const duration_millis OPRF_duration = OPRF_end_time - OPRF_start_time;
-  context.timings.oprf = OPRF_duration.count();
+  context.timings.oprf = OPRF_timer.Stop();
+  context.communication.oprf = ChannelCommunication(sendChl) - baseots_communication;
 
   sendChl.close();
   ep.stop();
-  ios.stop();
+  if (own_ios) {
+    own_ios->stop();
+  }
   return outputs;
 }
 
+PsiAnalyticsContext::Communication ChannelCommunication(const osuCrypto::Channel &channel) {
+  PsiAnalyticsContext::Communication communication;
+  communication.sent_bytes = channel.getTotalDataSent();
+  communication.received_bytes = channel.getTotalDataRecv();
+  return communication;
+}
+
 }
\ No newline at end of file
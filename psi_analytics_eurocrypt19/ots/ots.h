@@ -28,15 +28,23 @@
 #include <string>
 #include <vector>
 
+#include "common/binned_elements.h"
 #include "common/psi_analytics_context.h"
 #include "common/constants.h"
 
+namespace osuCrypto {
+class Channel;
+}
+
 namespace ENCRYPTO {
 
 std::vector<std::uint64_t> ot_receiver(const std::vector<std::uint64_t>& inputs,
                                        ENCRYPTO::PsiAnalyticsContext& context);
 
-std::vector<std::vector<std::uint64_t>> ot_sender(
-    const std::vector<std::vector<std::uint64_t>>& inputs, ENCRYPTO::PsiAnalyticsContext& context);
+// reads the bins in place and returns the OPRF outputs in the same layout
+BinnedElements ot_sender(const BinnedElements& inputs, ENCRYPTO::PsiAnalyticsContext& context);
+
+// the bytes sent and received on the channel so far
+PsiAnalyticsContext::Communication ChannelCommunication(const osuCrypto::Channel& channel);
 
 }
\ No newline at end of file
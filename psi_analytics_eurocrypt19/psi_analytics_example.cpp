@@ -8,8 +8,11 @@
 // \copyright The MIT License. Copyright Oleksandr Tkachenko
 //
 
+#include <algorithm>
 #include <cassert>
+#include <fstream>
 #include <iostream>
+#include <random>
 
 #include <boost/program_options.hpp>
 
@@ -17,18 +20,28 @@
 #include <ENCRYPTO_utils/parse_options.h>
 #include "abycore/aby/abyparty.h"
 
+#include "common/input_reader.h"
+#include "common/parameter_planner.h"
 #include "common/psi_analytics.h"
 #include "common/psi_analytics_context.h"
+#include "network/async_network_engine.h"
 
-auto read_test_options(int32_t argcp, char **argvp) {
+auto read_test_options(int32_t argcp, char **argvp, std::string &shares_file,
+                       std::string &metrics_file, std::string &trace_file,
+                       std::string &input_file, std::vector<std::uint64_t> &inputs) {
   namespace po = boost::program_options;
   ENCRYPTO::PsiAnalyticsContext context;
   po::options_description allowed("Allowed options");
-  std::string type;
+  std::string type, circuit, backend, record_format;
+  bool plan, calibrate, track_memory;
+  ENCRYPTO::PlannerInput planner_input;
+  std::size_t io_threads;
   // clang-format off
   allowed.add_options()("help,h", "produce this message")
   ("role,r",         po::value<decltype(context.role)>(&context.role)->required(),                                  "Role of the node")
   ("neles,n",        po::value<decltype(context.neles)>(&context.neles)->default_value(1000u),                      "Number of my elements")
+  ("input-file,I",   po::value<std::string>(&input_file)->default_value(""),                                        "File with my records, one per line by default, overrides --neles")
+  ("records,R",      po::value<std::string>(&record_format)->default_value("Lines"),                                "Format of the records in the input file {Lines, LengthPrefixed}")
   ("bit-length,b",   po::value<decltype(context.bitlen)>(&context.bitlen)->default_value(61u),                      "Bit-length of the elements")
   ("epsilon,e",      po::value<decltype(context.epsilon)>(&context.epsilon)->default_value(2.4f),                   "Epsilon, a table size multiplier")
   ("address,a",      po::value<decltype(context.address)>(&context.address)->default_value("127.0.0.1"),            "IP address of the server")
@@ -36,10 +49,27 @@ auto read_test_options(int32_t argcp, char **argvp) {
   ("threads,t",      po::value<decltype(context.nthreads)>(&context.nthreads)->default_value(1),                    "Number of threads")
   ("others-neles,o", po::value<decltype(context.notherpartyselems)>(&context.notherpartyselems)->default_value(0u), "Number of other party's elements")
   ("threshold,c",    po::value<decltype(context.threshold)>(&context.threshold)->default_value(0u),                 "Show PSI size if it is > threshold")
+  ("thresholds,T",   po::value<decltype(context.thresholds)>(&context.thresholds)->multitoken(),                    "Several thresholds evaluated in one run, overrides --threshold")
+  ("output-sum,S",   po::bool_switch(&context.output_sum),                                                          "Also output the PSI size for (SumIf)Threshold")
   ("nmegabins,m",    po::value<decltype(context.nmegabins)>(&context.nmegabins)->default_value(1u),                 "Number of mega bins")
   ("polysize,s",     po::value<decltype(context.polynomialsize)>(&context.polynomialsize)->default_value(0u),       "Size of the polynomial(s), default: neles")
+  ("shards,k",       po::value<decltype(context.nshards)>(&context.nshards)->default_value(1u),                     "Number of shards that are processed one after the other to bound the memory")
+  ("stash-bins,z",   po::value<decltype(context.nstashbins)>(&context.nstashbins)->default_value(0u),               "Number of bins for the elements in the cuckoo stash")
   ("functions,f",    po::value<decltype(context.nfuns)>(&context.nfuns)->default_value(2u),                         "Number of hash functions in hash tables")
-  ("type,y",         po::value<std::string>(&type)->default_value("None"),                                          "Function type {None, Threshold, Sum, SumIfGtThreshold}");
+  ("plan,A",         po::bool_switch(&plan),                                                                        "Let the server's planner choose epsilon, functions, nmegabins and polysize for both parties")
+  ("bandwidth,W",    po::value<double>(&planner_input.bandwidth_mbps)->default_value(1000.0),                       "Bandwidth of the link in Mbit/s for the planner")
+  ("latency,L",      po::value<double>(&planner_input.latency_ms)->default_value(0.1),                              "Latency of the link in ms for the planner")
+  ("calibrate,C",    po::bool_switch(&calibrate),                                                                   "Plan with the cost model measured on the server's machine, implies --plan")
+  ("type,y",         po::value<std::string>(&type)->default_value("None"),                                          "Function type {None, Threshold, Sum, SumIfGtThreshold, PayloadSum, MatchShares, GroupedSum}")
+  ("payload-bits,l", po::value<decltype(context.payload_bitlen)>(&context.payload_bitlen)->default_value(32u),      "Bit-length of the server's payloads")
+  ("categories,g",   po::value<decltype(context.ncategories)>(&context.ncategories)->default_value(1u),             "Number of the server's categories for GroupedSum")
+  ("circuit,x",      po::value<std::string>(&circuit)->default_value("GmwArithmetic"),                              "Circuit type {Gmw, GmwArithmetic, Yao, YaoArithmetic}")
+  ("backend,B",      po::value<std::string>(&backend)->default_value("Aby"),                                        "Analytics backend {Aby, Native}")
+  ("shares-file,w",  po::value<std::string>(&shares_file)->default_value(""),                                     "Output file for MatchShares, default: match_shares_<role>.bin")
+  ("metrics-file,M", po::value<std::string>(&metrics_file)->default_value(""),                                    "Output JSON file for the phase timings and the communication of the run")
+  ("track-memory,G", po::bool_switch(&track_memory),                                                                "Record the RSS, the heap and the allocations of every phase")
+  ("trace-file,j",   po::value<std::string>(&trace_file)->default_value(""),                                      "Output Chrome trace file of the run, aligned to the other party's if it traces too")
+  ("io-threads,i",   po::value<decltype(io_threads)>(&io_threads)->default_value(0u),                               "Number of event-driven I/O threads for the network, 0: blocking sockets");
   // clang-format on
 
   po::variables_map vm;
@@ -60,6 +90,12 @@ auto read_test_options(int32_t argcp, char **argvp) {
     exit(EXIT_SUCCESS);
   }
 
+  context.metrics.TrackMemory(track_memory);
+  if (!trace_file.empty()) {
+    context.metrics.SetTrace(std::make_shared<ENCRYPTO::TraceRecorder>(
+        context.role, context.role == SERVER ? "server" : "client"));
+  }
+
   if (type.compare("None") == 0) {
     context.analytics_type = ENCRYPTO::PsiAnalyticsContext::NONE;
   } else if (type.compare("Threshold") == 0) {
@@ -68,16 +104,70 @@ auto read_test_options(int32_t argcp, char **argvp) {
     context.analytics_type = ENCRYPTO::PsiAnalyticsContext::SUM;
   } else if (type.compare("SumIfGtThreshold") == 0) {
     context.analytics_type = ENCRYPTO::PsiAnalyticsContext::SUM_IF_GT_THRESHOLD;
+  } else if (type.compare("PayloadSum") == 0) {
+    context.analytics_type = ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM;
+  } else if (type.compare("GroupedSum") == 0) {
+    context.analytics_type = ENCRYPTO::PsiAnalyticsContext::GROUPED_SUM;
+  } else if (type.compare("MatchShares") == 0) {
+    context.analytics_type = ENCRYPTO::PsiAnalyticsContext::MATCH_SHARES;
+    if (shares_file.empty()) {
+      shares_file = context.role == SERVER ? "match_shares_server.bin" : "match_shares_client.bin";
+    }
   } else {
     std::string error_msg(std::string("Unknown function type: " + type));
     throw std::runtime_error(error_msg.c_str());
   }
 
+  if (circuit.compare("GmwArithmetic") == 0) {
+    context.circuit_type = ENCRYPTO::PsiAnalyticsContext::GMW_ARITHMETIC;
+  } else if (circuit.compare("Gmw") == 0) {
+    context.circuit_type = ENCRYPTO::PsiAnalyticsContext::GMW;
+  } else if (circuit.compare("Yao") == 0) {
+    context.circuit_type = ENCRYPTO::PsiAnalyticsContext::YAO;
+  } else if (circuit.compare("YaoArithmetic") == 0) {
+    context.circuit_type = ENCRYPTO::PsiAnalyticsContext::YAO_ARITHMETIC;
+  } else {
+    std::string error_msg(std::string("Unknown circuit type: " + circuit));
+    throw std::runtime_error(error_msg.c_str());
+  }
+
+  if (backend.compare("Aby") == 0) {
+    context.analytics_backend = ENCRYPTO::PsiAnalyticsContext::ABY;
+  } else if (backend.compare("Native") == 0) {
+    context.analytics_backend = ENCRYPTO::PsiAnalyticsContext::NATIVE;
+  } else {
+    std::string error_msg(std::string("Unknown analytics backend: " + backend));
+    throw std::runtime_error(error_msg.c_str());
+  }
+
+  if (io_threads > 0) {
+    context.network_engine = std::make_shared<ENCRYPTO::AsyncNetworkEngine>(io_threads);
+  }
+
+  // the records of the input file are hashed to elements, which replace the synthetic ones
+  if (!input_file.empty()) {
+    ENCRYPTO::RecordFormat format;
+    if (record_format.compare("Lines") == 0) {
+      format = ENCRYPTO::RecordFormat::LINES;
+    } else if (record_format.compare("LengthPrefixed") == 0) {
+      format = ENCRYPTO::RecordFormat::LENGTH_PREFIXED;
+    } else {
+      std::string error_msg(std::string("Unknown record format: " + record_format));
+      throw std::runtime_error(error_msg.c_str());
+    }
+    inputs = ENCRYPTO::ReadElementsFromFile(input_file, format, context.nthreads);
+    if (inputs.empty()) {
+      throw std::runtime_error("The input file has no records: " + input_file);
+    }
+    context.neles = inputs.size();
+  }
+
   if (context.notherpartyselems == 0) {
     context.notherpartyselems = context.neles;
   }
 
   if (context.polynomialsize == 0) {
+    // sized for all elements; RunShardedPsi scales it down to the shards
     context.polynomialsize = context.neles * context.nfuns;
   }
   context.polynomialbytelength = context.polynomialsize * sizeof(std::uint64_t);
@@ -86,15 +176,76 @@ auto read_test_options(int32_t argcp, char **argvp) {
       context.role == CLIENT ? context.neles : context.notherpartyselems;
   context.nbins = client_neles * context.epsilon;
 
+  // the server plans with its (calibrated) cost model and sends the parameters to the client
+  if (plan || calibrate) {
+    ENCRYPTO::PsiParameters parameters{};
+    if (context.role == SERVER) {
+      planner_input.client_neles = client_neles;
+      planner_input.server_neles = context.neles;
+      ENCRYPTO::CostModel model;
+      if (calibrate) {
+        model = ENCRYPTO::CalibrateCostModel(context.port);
+        std::cout << "Cost model: interpolation " << model.interpolation_ns_per_point_squared
+                  << " ns * k^2 + " << model.interpolation_ns_per_point << " ns * k, evaluation "
+                  << model.evaluation_ns_per_coefficient << " ns per coefficient, hashing "
+                  << model.hashing_ns_per_element << " ns per element, OPRF "
+                  << model.oprf_ns_per_bin << " ns per bin and " << model.oprf_ns_per_element
+                  << " ns per element\n";
+      }
+      parameters = ENCRYPTO::PlanParameters(planner_input, model);
+    }
+    ENCRYPTO::ExchangeParameters(parameters, context);
+    std::cout << "Planned parameters: " << parameters.nfuns << " hash functions, epsilon "
+              << parameters.epsilon << ", " << parameters.nmegabins << " mega bins, polysize "
+              << parameters.polynomialsize << ", predicted runtime " << parameters.predicted_ms
+              << " ms\n";
+    ENCRYPTO::ApplyParameters(parameters, context);
+  }
+
   return context;
 }
 
 int main(int argc, char **argv) {
-  auto context = read_test_options(argc, argv);
-  auto gen_bitlen = static_cast<std::size_t>(std::ceil(std::log2(context.neles))) + 3;
-  auto inputs = ENCRYPTO::GeneratePseudoRandomElements(context.neles, gen_bitlen);
-  ENCRYPTO::run_psi_analytics(inputs, context);
+  std::string shares_file, metrics_file, trace_file, input_file;
+  std::vector<std::uint64_t> inputs;
+  auto context =
+      read_test_options(argc, argv, shares_file, metrics_file, trace_file, input_file, inputs);
+  if (input_file.empty()) {
+    auto gen_bitlen = static_cast<std::size_t>(std::ceil(std::log2(context.neles))) + 3;
+    inputs = ENCRYPTO::GeneratePseudoRandomElements(context.neles, gen_bitlen, 12345,
+                                                    context.nthreads);
+  }
+
+  // the server attaches a pseudo-random payload or category to each of its elements
+  std::vector<std::uint64_t> payloads;
+  if (context.role == SERVER &&
+      (context.analytics_type == ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM ||
+       context.analytics_type == ENCRYPTO::PsiAnalyticsContext::GROUPED_SUM)) {
+    std::mt19937 engine(54321);
+    std::uniform_int_distribution<std::uint64_t> dist(
+        0, context.analytics_type == ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM
+               ? (1ull << context.payload_bitlen) - 1
+               : context.ncategories - 1);
+    payloads.resize(inputs.size());
+    std::generate(payloads.begin(), payloads.end(), [&]() { return dist(engine); });
+  }
+
+  if (context.analytics_type == ENCRYPTO::PsiAnalyticsContext::MATCH_SHARES) {
+    auto match_shares = ENCRYPTO::run_psi_match_shares(inputs, context);
+    ENCRYPTO::WriteMatchShares(match_shares, shares_file);
+    std::cout << "Wrote the shares of " << match_shares.nbins << " bins to " << shares_file << "\n";
+  } else {
+    ENCRYPTO::run_psi_analytics(inputs, payloads, context);
+  }
   std::cout << "PSI circuit successfully executed" << std::endl;
   PrintTimings(context);
+  PrintCommunication(context);
+  PrintMemoryUsage(context);
+  if (!metrics_file.empty()) {
+    std::ofstream(metrics_file) << ENCRYPTO::GetMetricsJson(context) << '\n';
+  }
+  if (!trace_file.empty()) {
+    std::ofstream(trace_file) << context.metrics.GetTrace()->ToJson();
+  }
   return EXIT_SUCCESS;
 }
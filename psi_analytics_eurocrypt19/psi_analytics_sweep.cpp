@@ -0,0 +1,269 @@
+//
+// \file psi_analytics_sweep.cpp
+// \author Oleksandr Tkachenko
+// \email tkachenko@encrypto.cs.tu-darmstadt.de
+// \organization Cryptography and Privacy Engineering Group (ENCRYPTO)
+// \TU Darmstadt, Computer Science department
+//
+// \copyright The MIT License. Copyright Oleksandr Tkachenko
+//
+
+// Runs both parties in two threads of this process for every point of a parameter grid and writes
+// the mean, the standard deviation, the minimum and the maximum of every timing (in ms) and every
+// communication counter over the repetitions as CSV and/or JSON, one record per point and role.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+
+#include <boost/program_options.hpp>
+
+#include "common/helpers.h"
+#include "common/parameter_planner.h"
+#include "common/psi_analytics.h"
+#include "common/psi_analytics_context.h"
+
+namespace {
+
+const std::map<std::string, decltype(ENCRYPTO::PsiAnalyticsContext::analytics_type)>
+    analytics_types{{"None", ENCRYPTO::PsiAnalyticsContext::NONE},
+                    {"Threshold", ENCRYPTO::PsiAnalyticsContext::THRESHOLD},
+                    {"Sum", ENCRYPTO::PsiAnalyticsContext::SUM},
+                    {"SumIfGtThreshold", ENCRYPTO::PsiAnalyticsContext::SUM_IF_GT_THRESHOLD},
+                    {"PayloadSum", ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM},
+                    {"GroupedSum", ENCRYPTO::PsiAnalyticsContext::GROUPED_SUM}};
+
+struct SweepPoint {
+  uint64_t client_neles;
+  uint64_t server_neles;
+  uint64_t nmegabins;
+  uint64_t polynomialsize;
+  uint64_t nthreads;
+  std::string type;
+};
+
+struct Statistics {
+  double mean, stddev, min, max;
+};
+
+Statistics ComputeStatistics(const std::vector<double> &values) {
+  Statistics statistics{0, 0, *std::min_element(values.begin(), values.end()),
+                        *std::max_element(values.begin(), values.end())};
+  for (auto value : values) {
+    statistics.mean += value / values.size();
+  }
+  for (auto value : values) {
+    statistics.stddev += (value - statistics.mean) * (value - statistics.mean);
+  }
+  // the sample standard deviation, 0 for a single repetition
+  statistics.stddev =
+      values.size() > 1 ? std::sqrt(statistics.stddev / (values.size() - 1)) : 0.0;
+  return statistics;
+}
+
+// the metrics of one role at one point: the repetitions of every timing in the order of GetTimings
+// followed by those of the communication counters in the order of GetCommunication
+struct Measurement {
+  SweepPoint point;
+  std::string role;
+  std::vector<std::string> names;
+  std::vector<std::vector<double>> repetitions;
+};
+
+// runs the client and the server on pseudo-random sets and returns their contexts
+std::vector<ENCRYPTO::PsiAnalyticsContext> RunPoint(const SweepPoint &point, uint16_t port,
+                                                     double epsilon, uint64_t nfuns,
+                                                     std::size_t repetition) {
+  std::vector<ENCRYPTO::PsiAnalyticsContext> contexts;
+  for (auto role : {CLIENT, SERVER}) {
+    ENCRYPTO::PsiAnalyticsContext context{port, role};
+    context.bitlen = 61;
+    context.neles = role == CLIENT ? point.client_neles : point.server_neles;
+    context.notherpartyselems = role == CLIENT ? point.server_neles : point.client_neles;
+    context.nbins = static_cast<uint64_t>(point.client_neles * epsilon);
+    context.nthreads = point.nthreads;
+    context.nfuns = nfuns;
+    context.threshold = point.client_neles / 2;
+    context.nmegabins = point.nmegabins;
+    // the smallest polynomial size that fits the server's points of every mega bin
+    context.polynomialsize =
+        point.polynomialsize > 0
+            ? point.polynomialsize
+            : ENCRYPTO::MinPolynomialSize(point.server_neles * nfuns, context.nbins,
+                                          point.nmegabins, 40);
+    context.polynomialbytelength = context.polynomialsize * sizeof(uint64_t);
+    context.epsilon = epsilon;
+    context.address = "127.0.0.1";
+    context.analytics_type = analytics_types.at(point.type);
+    context.ncategories = 4;
+    context.timings = {};
+    contexts.push_back(context);
+  }
+
+  // about half of the client's elements are in the intersection
+  const auto bitlen =
+      static_cast<std::size_t>(std::ceil(std::log2(std::max(point.server_neles, uint64_t(2))))) +
+      1;
+  const auto client_inputs =
+      ENCRYPTO::GeneratePseudoRandomElements(point.client_neles, bitlen, 2 * repetition);
+  const auto server_inputs =
+      ENCRYPTO::GeneratePseudoRandomElements(point.server_neles, bitlen, 2 * repetition + 1);
+  std::vector<std::uint64_t> server_payloads(point.server_neles);
+  std::mt19937 engine(repetition);
+  std::generate(server_payloads.begin(), server_payloads.end(), [&]() { return engine() % 4; });
+
+  std::thread client_thread(
+      [&]() { ENCRYPTO::run_psi_analytics(client_inputs, {}, contexts.at(0)); });
+  std::thread server_thread(
+      [&]() { ENCRYPTO::run_psi_analytics(server_inputs, server_payloads, contexts.at(1)); });
+  client_thread.join();
+  server_thread.join();
+  return contexts;
+}
+
+std::string PointColumns(const SweepPoint &point, char separator) {
+  return std::to_string(point.client_neles) + separator + std::to_string(point.server_neles) +
+         separator + std::to_string(point.nmegabins) + separator +
+         std::to_string(point.polynomialsize) + separator + std::to_string(point.nthreads) +
+         separator + point.type;
+}
+
+void WriteCsv(const std::vector<Measurement> &measurements, const std::string &path) {
+  std::ofstream csv(path);
+  csv << "client_neles,server_neles,nmegabins,polynomialsize,nthreads,type,role,repetitions";
+  for (const auto &name : measurements.front().names) {
+    csv << ',' << name << "_mean," << name << "_stddev," << name << "_min," << name << "_max";
+  }
+  csv << '\n';
+  for (const auto &measurement : measurements) {
+    csv << PointColumns(measurement.point, ',') << ',' << measurement.role << ','
+        << measurement.repetitions.front().size();
+    for (const auto &values : measurement.repetitions) {
+      const auto statistics = ComputeStatistics(values);
+      csv << ',' << statistics.mean << ',' << statistics.stddev << ',' << statistics.min << ','
+          << statistics.max;
+    }
+    csv << '\n';
+  }
+}
+
+void WriteJson(const std::vector<Measurement> &measurements, const std::string &path) {
+  std::ofstream json(path);
+  json << "[\n";
+  for (auto m = 0ull; m < measurements.size(); ++m) {
+    const auto &measurement = measurements.at(m);
+    const auto &point = measurement.point;
+    json << "  {\"client_neles\": " << point.client_neles
+         << ", \"server_neles\": " << point.server_neles << ", \"nmegabins\": " << point.nmegabins
+         << ", \"polynomialsize\": " << point.polynomialsize
+         << ", \"nthreads\": " << point.nthreads << ", \"type\": \"" << point.type
+         << "\", \"role\": \"" << measurement.role
+         << "\", \"repetitions\": " << measurement.repetitions.front().size()
+         << ", \"metrics\": {";
+    for (auto i = 0ull; i < measurement.names.size(); ++i) {
+      const auto statistics = ComputeStatistics(measurement.repetitions.at(i));
+      json << (i == 0 ? "" : ", ") << '"' << measurement.names.at(i)
+           << "\": {\"mean\": " << statistics.mean << ", \"stddev\": " << statistics.stddev
+           << ", \"min\": " << statistics.min << ", \"max\": " << statistics.max << '}';
+    }
+    json << "}}" << (m + 1 < measurements.size() ? "," : "") << '\n';
+  }
+  json << "]\n";
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  namespace po = boost::program_options;
+  std::vector<uint64_t> neles_values, nmegabins_values, polysize_values, nthreads_values;
+  std::vector<double> asymmetries;
+  std::vector<std::string> types;
+  std::size_t repetitions;
+  double epsilon;
+  uint64_t nfuns;
+  uint16_t port;
+  std::string csv_file, json_file;
+
+  // clang-format off
+  po::options_description allowed("Allowed options");
+  allowed.add_options()("help,h", "produce this message")
+  ("neles,n",       po::value<decltype(neles_values)>(&neles_values)->multitoken()->default_value({4096}, "4096"),       "Numbers of the client's elements")
+  ("asymmetry,r",   po::value<decltype(asymmetries)>(&asymmetries)->multitoken()->default_value({1.0}, "1"),            "Ratios of the server's to the client's number of elements")
+  ("nmegabins,m",   po::value<decltype(nmegabins_values)>(&nmegabins_values)->multitoken()->default_value({16}, "16"),  "Numbers of mega bins")
+  ("polysize,s",    po::value<decltype(polysize_values)>(&polysize_values)->multitoken()->default_value({0}, "0"),      "Polynomial sizes, 0: the smallest safe one for the mega bins")
+  ("threads,t",     po::value<decltype(nthreads_values)>(&nthreads_values)->multitoken()->default_value({1}, "1"),      "Numbers of threads")
+  ("type,y",        po::value<decltype(types)>(&types)->multitoken()->default_value({"Sum"}, "Sum"),                    "Function types {None, Threshold, Sum, SumIfGtThreshold, PayloadSum, GroupedSum}")
+  ("repetitions,N", po::value<decltype(repetitions)>(&repetitions)->default_value(3u),                                  "Runs per point")
+  ("epsilon,e",     po::value<decltype(epsilon)>(&epsilon)->default_value(1.27),                                        "Epsilon, a table size multiplier")
+  ("functions,f",   po::value<decltype(nfuns)>(&nfuns)->default_value(3u),                                              "Number of hash functions in hash tables")
+  ("port,p",        po::value<decltype(port)>(&port)->default_value(7777),                                              "Local port of the runs")
+  ("csv,c",         po::value<decltype(csv_file)>(&csv_file)->default_value(""),                                        "Output CSV file")
+  ("json,j",        po::value<decltype(json_file)>(&json_file)->default_value(""),                                      "Output JSON file");
+  // clang-format on
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, allowed), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    std::cout << allowed << "\n";
+    return EXIT_SUCCESS;
+  }
+  if (repetitions == 0) {
+    throw std::runtime_error("At least one repetition is needed");
+  }
+  for (const auto &type : types) {
+    if (analytics_types.count(type) == 0) {
+      throw std::runtime_error("Unknown function type: " + type);
+    }
+  }
+
+  std::vector<Measurement> measurements;
+  for (auto neles : neles_values)
+    for (auto asymmetry : asymmetries)
+      for (auto nmegabins : nmegabins_values)
+        for (auto polynomialsize : polysize_values)
+          for (auto nthreads : nthreads_values)
+            for (const auto &type : types) {
+              const SweepPoint point{neles, static_cast<uint64_t>(std::llround(neles * asymmetry)),
+                                     nmegabins, polynomialsize, nthreads, type};
+              Measurement client{point, "client"}, server{point, "server"};
+              for (auto repetition = 0ull; repetition < repetitions; ++repetition) {
+                const auto contexts = RunPoint(point, port, epsilon, nfuns, repetition);
+                for (auto measurement : {&client, &server}) {
+                  const auto &context = contexts.at(measurement == &client ? 0 : 1);
+                  auto metrics = ENCRYPTO::GetTimings(context);
+                  for (const auto &phase : ENCRYPTO::GetCommunication(context)) {
+                    metrics.emplace_back(phase.first + "_sent_bytes", phase.second.sent_bytes);
+                    metrics.emplace_back(phase.first + "_received_bytes",
+                                         phase.second.received_bytes);
+                    metrics.emplace_back(phase.first + "_sent_messages",
+                                         phase.second.sent_messages);
+                    metrics.emplace_back(phase.first + "_received_messages",
+                                         phase.second.received_messages);
+                  }
+                  measurement->names.clear();
+                  measurement->repetitions.resize(metrics.size());
+                  for (auto i = 0ull; i < metrics.size(); ++i) {
+                    measurement->names.push_back(metrics.at(i).first);
+                    measurement->repetitions.at(i).push_back(metrics.at(i).second);
+                  }
+                }
+                std::cout << PointColumns(point, ' ') << " run " << repetition + 1 << "/"
+                          << repetitions << ": " << contexts.at(0).timings.total << " ms\n";
+              }
+              measurements.push_back(client);
+              measurements.push_back(server);
+            }
+
+  if (!csv_file.empty()) {
+    WriteCsv(measurements, csv_file);
+  }
+  if (!json_file.empty()) {
+    WriteJson(measurements, json_file);
+  }
+  return EXIT_SUCCESS;
+}
@@ -7,15 +7,35 @@
 //
 // \copyright The MIT License. Copyright Oleksandr Tkachenko
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <random>
 #include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "gtest/gtest.h"
 
 #include "common/psi_analytics.h"
+#include "common/constants.h"
+#include "common/input_reader.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "common/parameter_planner.h"
+#include "common/parallel_hashing.h"
+#include "common/preprocessing.h"
 #include "common/psi_analytics_context.h"
+#include "network/async_network_engine.h"
 
-#include "HashingTables/cuckoo_hashing/cuckoo_hashing.h"
-#include "HashingTables/simple_hashing/simple_hashing.h"
+#include "HashingTables/common/hashing.h"
 
 constexpr std::size_t ITERATIONS = 1;
 
@@ -196,6 +216,632 @@ void PsiAnalyticsTest(std::size_t elem_bitlen, bool random, uint64_t neles, uint
   ASSERT_EQ(psi_server, plain_intersection_size);
 }
 
+TEST(PSI_ANALYTICS, pow_2_12_network_engine) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+
+  // both sessions share the I/O threads of one engine
+  auto engine = std::make_shared<ENCRYPTO::AsyncNetworkEngine>(2);
+  client_context.network_engine = server_context.network_engine = engine;
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(client_context.neles, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(server_context.neles, 15, 1);
+
+  std::uint64_t psi_client, psi_server;
+
+  std::thread client_thread(
+      [&]() { psi_client = run_psi_analytics(client_inputs, client_context); });
+  std::thread server_thread(
+      [&]() { psi_server = run_psi_analytics(server_inputs, server_context); });
+
+  client_thread.join();
+  server_thread.join();
+
+  auto plain_intersection_size = ENCRYPTO::PlainIntersectionSize(client_inputs, server_inputs);
+
+  ASSERT_EQ(psi_client, plain_intersection_size);
+  ASSERT_EQ(psi_server, plain_intersection_size);
+
+  // every mega bin is a message of its own
+  ASSERT_EQ(client_context.communication.polynomials.received_messages, NMEGABINS_2_12);
+  ASSERT_EQ(server_context.communication.polynomials.sent_messages, NMEGABINS_2_12);
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_network_engine_concurrent_runs) {
+  constexpr std::size_t nruns = 2;
+  auto engine = std::make_shared<ENCRYPTO::AsyncNetworkEngine>(2);
+
+  std::vector<ENCRYPTO::PsiAnalyticsContext> client_contexts, server_contexts;
+  std::vector<std::vector<std::uint64_t>> client_inputs, server_inputs;
+  for (auto run = 0ull; run < nruns; ++run) {
+    client_contexts.push_back(
+        CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12));
+    server_contexts.push_back(
+        CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12));
+    // the runs must not share a port
+    client_contexts.back().port = server_contexts.back().port = 7777 + 10 * run;
+    client_contexts.back().network_engine = server_contexts.back().network_engine = engine;
+
+    client_inputs.push_back(ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 2 * run));
+    server_inputs.push_back(ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 2 * run + 1));
+  }
+
+  std::vector<std::uint64_t> psi_client(nruns), psi_server(nruns);
+  std::vector<std::thread> threads;
+  for (auto run = 0ull; run < nruns; ++run) {
+    threads.emplace_back([&, run]() {
+      psi_client.at(run) = run_psi_analytics(client_inputs.at(run), client_contexts.at(run));
+    });
+    threads.emplace_back([&, run]() {
+      psi_server.at(run) = run_psi_analytics(server_inputs.at(run), server_contexts.at(run));
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (auto run = 0ull; run < nruns; ++run) {
+    auto plain_intersection_size =
+        ENCRYPTO::PlainIntersectionSize(client_inputs.at(run), server_inputs.at(run));
+    ASSERT_EQ(psi_client.at(run), plain_intersection_size);
+    ASSERT_EQ(psi_server.at(run), plain_intersection_size);
+    // the socket of the handshake is closed at the end of the run
+    ASSERT_EQ(client_contexts.at(run).network_fd, -1);
+    ASSERT_EQ(server_contexts.at(run).network_fd, -1);
+  }
+}
+
+TEST(PSI_ANALYTICS, network_engine_stopped_accept) {
+  ENCRYPTO::AsyncNetworkEngine engine;
+  std::promise<int> accepted;
+  engine.AsyncAccept("127.0.0.1", 7777, [&accepted](int fd) { accepted.set_value(fd); });
+
+  // nobody connects, so the pending accept fails once the engine stops
+  engine.Stop();
+  ASSERT_EQ(accepted.get_future().get(), -1);
+}
+
+TEST(PSI_ANALYTICS, network_engine_reset) {
+  ENCRYPTO::AsyncNetworkEngine engine;
+  int other_fd;
+  std::thread connecting([&]() { other_fd = engine.Connect("127.0.0.1", 7777); });
+  const int fd = engine.Accept("127.0.0.1", 7777);
+  connecting.join();
+
+  // the other side resets the connection while the socket has no pending operations
+  const std::uint8_t byte = 1;
+  ASSERT_TRUE(engine.Send(fd, &byte, sizeof(byte)).get());
+  linger reset{1, 0};
+  setsockopt(other_fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+  close(other_fd);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // later operations fail instead of bringing down the engine
+  std::uint8_t received;
+  ASSERT_FALSE(engine.Receive(fd, &received, sizeof(received)).get());
+  ASSERT_FALSE(engine.Send(fd, &byte, sizeof(byte)).get());
+  engine.Close(fd);
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_communication) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(client_context.neles, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(server_context.neles, 15, 1);
+
+  std::thread client_thread([&]() { run_psi_analytics(client_inputs, client_context); });
+  std::thread server_thread([&]() { run_psi_analytics(server_inputs, server_context); });
+
+  client_thread.join();
+  server_thread.join();
+
+  // what one party sends in a phase is what the other one receives
+  const auto client_communication = ENCRYPTO::GetCommunication(client_context);
+  const auto server_communication = ENCRYPTO::GetCommunication(server_context);
+  ASSERT_EQ(client_communication.size(), server_communication.size());
+  for (auto i = 0ull; i < client_communication.size(); ++i) {
+    ASSERT_EQ(client_communication.at(i).second.sent_bytes,
+              server_communication.at(i).second.received_bytes);
+    ASSERT_EQ(client_communication.at(i).second.received_bytes,
+              server_communication.at(i).second.sent_bytes);
+  }
+
+  ASSERT_GT(client_context.communication.oprf.sent_bytes, 0u);
+  ASSERT_GT(server_context.communication.aby_online.sent_bytes, 0u);
+  ASSERT_EQ(client_context.communication.polynomials.received_bytes,
+            NMEGABINS_2_12 * server_context.polynomialbytelength);
+  ASSERT_EQ(client_context.communication.polynomials.received_messages, 1u);
+
+  // the timings are filled from the timers of the metrics registry
+  for (const auto context : {&client_context, &server_context}) {
+    ASSERT_GT(context->metrics.Get("opprf"), 0.0);
+    ASSERT_EQ(context->timings.opprf, context->metrics.Get("opprf"));
+    ASSERT_EQ(context->timings.hashing, context->metrics.Get("opprf/hashing"));
+    ASSERT_EQ(context->timings.total, context->metrics.Get("total"));
+    ASSERT_GE(context->timings.opprf, context->timings.hashing + context->timings.oprf);
+  }
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_memory_usage) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  client_context.metrics.TrackMemory(true);
+  server_context.metrics.TrackMemory(true);
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(client_context.neles, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(server_context.neles, 15, 1);
+
+  std::thread client_thread([&]() { run_psi_analytics(client_inputs, client_context); });
+  std::thread server_thread([&]() { run_psi_analytics(server_inputs, server_context); });
+
+  client_thread.join();
+  server_thread.join();
+
+  for (const auto context : {&client_context, &server_context}) {
+    const auto total = context->metrics.GetMemoryUsage("total");
+    for (const auto phase : {"opprf/hashing", "opprf/oprf", "opprf/polynomials",
+                             "analytics/execution"}) {
+      const auto usage = context->metrics.GetMemoryUsage(phase);
+      ASSERT_GT(usage.rss_bytes, 0u) << phase;
+      // the run contains the phase, so the peak RSS grew at least as much during the run
+      ASSERT_LE(usage.rss_hwm_increase_bytes, total.rss_hwm_increase_bytes) << phase;
+      if (ENCRYPTO::AllocationTrackingEnabled()) {
+        ASSERT_GT(usage.allocations, 0u) << phase;
+        ASSERT_GT(usage.allocated_bytes, 0u) << phase;
+        ASSERT_LE(usage.allocated_bytes, total.allocated_bytes) << phase;
+        ASSERT_LE(usage.heap_peak_bytes, total.heap_peak_bytes) << phase;
+      }
+    }
+  }
+
+  // the client holds all received polynomials at once
+  if (ENCRYPTO::AllocationTrackingEnabled()) {
+    ASSERT_GE(client_context.metrics.GetMemoryUsage("opprf/polynomials").heap_peak_bytes,
+              client_context.nmegabins * client_context.polynomialbytelength);
+
+    // the simple table is filled in place, so besides it only the element index and the bin of
+    // every entry are live
+    const auto elements = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 61, 0);
+    const auto heap_bytes = ENCRYPTO::MemoryPhase().End().heap_bytes;
+    ENCRYPTO::MemoryPhase hashing;
+    const auto simple_table = ENCRYPTO::ParallelSimpleHashing(elements, server_context);
+    const auto table_bytes = sizeof(std::uint64_t) *
+                             (simple_table.elements.size() + simple_table.offsets.size());
+    ASSERT_LE(hashing.End().heap_peak_bytes - heap_bytes,
+              table_bytes + elements.size() * server_context.nfuns * 2 * sizeof(std::uint32_t) +
+                  (1 << 16));
+  }
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_trace) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto client_trace = std::make_shared<ENCRYPTO::TraceRecorder>(CLIENT, "client");
+  auto server_trace = std::make_shared<ENCRYPTO::TraceRecorder>(SERVER, "server");
+  client_context.metrics.SetTrace(client_trace);
+  server_context.metrics.SetTrace(server_trace);
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(client_context.neles, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(server_context.neles, 15, 1);
+
+  std::thread client_thread([&]() { run_psi_analytics(client_inputs, client_context); });
+  std::thread server_thread([&]() { run_psi_analytics(server_inputs, server_context); });
+
+  client_thread.join();
+  server_thread.join();
+
+  // both parties use the same clock here, so the estimated offset is below the round trip time
+  ASSERT_LT(std::abs(client_trace->GetClockOffset()), 10000.0);
+  ASSERT_EQ(server_trace->GetClockOffset(), 0.0);
+
+  const auto client_json = client_trace->ToJson(), server_json = server_trace->ToJson();
+  for (const auto &json : {client_json, server_json}) {
+    ASSERT_NE(json.find("\"name\": \"opprf/hashing\""), std::string::npos);
+    ASSERT_NE(json.find("\"name\": \"KKRT init\""), std::string::npos);
+    ASSERT_NE(json.find("\"name\": \"ABY online\""), std::string::npos);
+  }
+  ASSERT_NE(server_json.find("interpolate mega bin " + std::to_string(NMEGABINS_2_12 - 1)),
+            std::string::npos);
+  ASSERT_NE(client_json.find("evaluate mega bin " + std::to_string(NMEGABINS_2_12 - 1)),
+            std::string::npos);
+
+  // a party without a trace skips the clock synchronization of the other one, which drops the
+  // offset of the earlier run
+  client_trace->Clear();
+  client_trace->SetClockOffset(12345.0);
+  server_context.metrics.SetTrace(nullptr);
+  client_thread = std::thread([&]() { run_psi_analytics(client_inputs, client_context); });
+  server_thread = std::thread([&]() { run_psi_analytics(server_inputs, server_context); });
+  client_thread.join();
+  server_thread.join();
+  ASSERT_GT(client_trace->GetNumOfEvents(), 0u);
+  ASSERT_EQ(client_trace->GetClockOffset(), 0.0);
+}
+
+TEST(PSI_ANALYTICS, metrics_registry) {
+  ENCRYPTO::MetricsRegistry metrics;
+  metrics.Add("opprf/oprf/base_ots", 2.0);
+  metrics.Add("opprf", 5.0);
+  metrics.Add("analytics/online", 1.5);
+  ASSERT_EQ(metrics.Get("opprf/oprf"), 0.0);
+  ASSERT_EQ(metrics.ToJson(),
+            "{\"opprf\": {\"ms\": 5.000000, \"phases\": {\"oprf\": {\"phases\": {\"base_ots\": "
+            "{\"ms\": 2.000000}}}}}, \"analytics\": {\"phases\": {\"online\": {\"ms\": "
+            "1.500000}}}}");
+
+  auto timer = metrics.Time("total");
+  const auto elapsed = timer.Stop();
+  ASSERT_EQ(metrics.Get("total"), elapsed);
+  ASSERT_EQ(timer.Stop(), 0.0);
+
+  // copies are independent, merging adds up the phases
+  auto copy = metrics;
+  copy.Merge(metrics);
+  ASSERT_EQ(copy.Get("opprf"), 10.0);
+  ASSERT_EQ(metrics.Get("opprf"), 5.0);
+  copy.Clear();
+  ASSERT_TRUE(copy.GetPhases().empty());
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_reused_circuit_session) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+
+  std::uint64_t psi_client, psi_server;
+
+  std::thread client_thread([&]() {
+    ENCRYPTO::AnalyticsCircuitSession session(client_context);
+    for (auto seed = 0ull; seed < 2; ++seed) {
+      auto inputs = ENCRYPTO::GeneratePseudoRandomElements(client_context.neles, 15, seed);
+      // nothing of the previous query is left in the timings
+      client_context.timings.aby_preparation_hidden = -1;
+      psi_client = run_psi_analytics(inputs, client_context, session);
+      for (const auto &timing : ENCRYPTO::GetTimings(client_context)) {
+        EXPECT_GE(timing.second, 0) << timing.first;
+      }
+      auto other_inputs = ENCRYPTO::GeneratePseudoRandomElements(client_context.neles, 15, 2);
+      EXPECT_EQ(psi_client, ENCRYPTO::PlainIntersectionSize(inputs, other_inputs));
+    }
+  });
+  std::thread server_thread([&]() {
+    ENCRYPTO::AnalyticsCircuitSession session(server_context);
+    for (auto seed = 0ull; seed < 2; ++seed) {
+      auto inputs = ENCRYPTO::GeneratePseudoRandomElements(server_context.neles, 15, 2);
+      psi_server = run_psi_analytics(inputs, server_context, session);
+      auto other_inputs = ENCRYPTO::GeneratePseudoRandomElements(server_context.neles, 15, seed);
+      EXPECT_EQ(psi_server, ENCRYPTO::PlainIntersectionSize(inputs, other_inputs));
+    }
+  });
+
+  client_thread.join();
+  server_thread.join();
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_cuckoo_stash_rate) {
+  constexpr std::size_t nruns = 1000;
+  for (const auto &configuration : ENCRYPTO::cuckoo_configurations) {
+    auto context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+    context.nfuns = configuration.nfuns;
+    context.nbins = static_cast<uint64_t>(NELES_2_12 * configuration.epsilon);
+    std::size_t nstashing_runs = 0, max_stash_size = 0;
+    std::vector<std::uint64_t> stash;
+    for (auto seed = 0ull; seed < nruns; ++seed) {
+      const auto elements = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 61, seed);
+      ENCRYPTO::ParallelCuckooHashing(elements, context, &stash);
+      nstashing_runs += !stash.empty();
+      max_stash_size = std::max(max_stash_size, stash.size());
+    }
+    if (configuration.stashless) {
+      ASSERT_EQ(nstashing_runs, 0u) << configuration.nfuns;
+    } else {
+      // about one run in 1000 stashes an element, which a few stash bins take
+      ASSERT_LE(nstashing_runs, nruns / 100) << configuration.nfuns;
+      ASSERT_LE(max_stash_size, 2u) << configuration.nfuns;
+    }
+  }
+
+  // the other function counts and smaller tables without stash bins are rejected
+  auto context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  const auto elements = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 61, 0);
+  std::vector<std::uint64_t> stash;
+  context.nfuns = 4;
+  ASSERT_THROW(ENCRYPTO::ParallelCuckooHashing(elements, context, &stash), std::runtime_error);
+  ASSERT_THROW(ENCRYPTO::ParallelSimpleHashing(elements, context), std::runtime_error);
+  context.nfuns = 3;
+  context.nbins = NELES_2_12 * 6 / 5;
+  ASSERT_THROW(ENCRYPTO::ParallelCuckooHashing(elements, context, &stash), std::runtime_error);
+  context.nstashbins = 3;
+  ENCRYPTO::ParallelCuckooHashing(elements, context, &stash);
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_parallel_hashing) {
+  auto context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto elements = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 61, 0);
+
+  // the batched kernel agrees with the scalar hash, also for the elements after the last full
+  // batch
+  const auto nelements = elements.size() - 1;
+  std::vector<std::uint32_t> addresses(nelements * context.nfuns);
+  ENCRYPTO::BinAddressesOf(elements.data(), nelements, context.nfuns, context.nbins,
+                           addresses.data());
+  for (auto i = 0ull; i < nelements; ++i) {
+    for (auto j = 0ull; j < context.nfuns; ++j) {
+      ASSERT_EQ(addresses.at(i * context.nfuns + j),
+                ENCRYPTO::BinAddressOf(elements.at(i), j, context.nbins));
+    }
+  }
+
+  // the tables do not depend on the number of threads
+  context.nthreads = 1;
+  std::vector<std::uint64_t> stash, other_stash;
+  const auto cuckoo_table = ENCRYPTO::ParallelCuckooHashing(elements, context, &stash);
+  const auto simple_table = ENCRYPTO::ParallelSimpleHashing(elements, context);
+  ASSERT_EQ(cuckoo_table.size(), context.nbins);
+  ASSERT_EQ(simple_table.GetNumOfBins(), context.nbins);
+  for (auto nthreads : {2ull, 3ull, 8ull}) {
+    context.nthreads = nthreads;
+    ASSERT_EQ(ENCRYPTO::ParallelCuckooHashing(elements, context, &other_stash), cuckoo_table);
+    ASSERT_EQ(other_stash, stash);
+    ASSERT_EQ(ENCRYPTO::ParallelSimpleHashing(elements, context), simple_table);
+  }
+
+  // the simple table has every element in all bins of its hash functions in the order of the
+  // input, the cuckoo table in one of them or in the stash
+  std::vector<std::vector<std::uint64_t>> expected_bins(context.nbins);
+  for (auto element : elements) {
+    for (auto j = 0ull; j < context.nfuns; ++j) {
+      auto &bin = expected_bins.at(ENCRYPTO::BinAddressOf(element, j, context.nbins));
+      if (bin.empty() || bin.back() != element) {
+        bin.push_back(element);
+      }
+    }
+  }
+  for (auto bin = 0ull; bin < expected_bins.size(); ++bin) {
+    const std::vector<std::uint64_t> simple_bin(simple_table.BinBegin(bin),
+                                                simple_table.BinEnd(bin));
+    ASSERT_EQ(simple_bin, expected_bins.at(bin));
+  }
+
+  std::vector<std::uint64_t> placed(stash);
+  for (auto bin = 0ull; bin < cuckoo_table.size(); ++bin) {
+    const auto element = cuckoo_table.at(bin);
+    if (element != ENCRYPTO::cuckoo_empty_bin) {
+      const auto &bin_elements = expected_bins.at(bin);
+      ASSERT_NE(std::find(bin_elements.begin(), bin_elements.end(), element), bin_elements.end());
+      placed.push_back(element);
+    }
+  }
+  std::sort(placed.begin(), placed.end());
+  auto sorted_elements = elements;
+  std::sort(sorted_elements.begin(), sorted_elements.end());
+  ASSERT_EQ(placed, sorted_elements);
+
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  client_context.nthreads = 2;
+  server_context.nthreads = 4;
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+
+  std::uint64_t psi_client, psi_server;
+  std::thread client_thread(
+      [&]() { psi_client = run_psi_analytics(client_inputs, client_context); });
+  std::thread server_thread(
+      [&]() { psi_server = run_psi_analytics(server_inputs, server_context); });
+
+  client_thread.join();
+  server_thread.join();
+
+  auto plain_intersection_size = ENCRYPTO::PlainIntersectionSize(client_inputs, server_inputs);
+  ASSERT_EQ(psi_client, plain_intersection_size);
+  ASSERT_EQ(psi_server, plain_intersection_size);
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_sharded) {
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+  auto server_payloads = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 20, 2);
+  auto plain_intersection_size = ENCRYPTO::PlainIntersectionSize(client_inputs, server_inputs);
+  auto plain_payload_sum =
+      ENCRYPTO::PlainIntersectionPayloadSum(client_inputs, server_inputs, server_payloads);
+
+  for (auto type : {ENCRYPTO::PsiAnalyticsContext::SUM, ENCRYPTO::PsiAnalyticsContext::THRESHOLD,
+                    ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM}) {
+    auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+    auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+    for (auto context : {&client_context, &server_context}) {
+      context->analytics_type = type;
+      context->nshards = 4;
+      context->thresholds = {plain_intersection_size - 1, plain_intersection_size};
+      context->output_sum = true;
+    }
+
+    std::uint64_t psi_client, psi_server;
+    std::thread client_thread(
+        [&]() { psi_client = run_psi_analytics(client_inputs, {}, client_context); });
+    std::thread server_thread([&]() {
+      psi_server = run_psi_analytics(server_inputs, server_payloads, server_context);
+    });
+
+    client_thread.join();
+    server_thread.join();
+
+    std::vector<std::uint64_t> expected_outputs{plain_intersection_size};
+    if (type == ENCRYPTO::PsiAnalyticsContext::THRESHOLD) {
+      expected_outputs = {1, 0, plain_intersection_size};
+    } else if (type == ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM) {
+      expected_outputs = {plain_payload_sum};
+    }
+    ASSERT_EQ(psi_client, expected_outputs.front());
+    ASSERT_EQ(psi_server, expected_outputs.front());
+    ASSERT_EQ(client_context.outputs, expected_outputs);
+    ASSERT_EQ(server_context.outputs, expected_outputs);
+  }
+
+  // the shards of a set stay within their capacity
+  std::vector<std::size_t> shard_sizes(4, 0);
+  for (auto element : ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 61, 3)) {
+    ++shard_sizes.at(ENCRYPTO::ShardOf(element, shard_sizes.size()));
+  }
+  for (auto shard_size : shard_sizes) {
+    ASSERT_LE(shard_size, ENCRYPTO::ShardCapacity(NELES_2_12, shard_sizes.size()));
+  }
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_stash_bins) {
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+  auto server_payloads = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 20, 2);
+
+  for (auto analytics_type :
+       {ENCRYPTO::PsiAnalyticsContext::SUM, ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM}) {
+    auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+    auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+    client_context.analytics_type = server_context.analytics_type = analytics_type;
+    client_context.nstashbins = server_context.nstashbins = 3;
+
+    std::uint64_t psi_client, psi_server;
+    std::thread client_thread(
+        [&]() { psi_client = run_psi_analytics(client_inputs, {}, client_context); });
+    std::thread server_thread([&]() {
+      psi_server = run_psi_analytics(server_inputs, server_payloads, server_context);
+    });
+
+    client_thread.join();
+    server_thread.join();
+
+    const auto expected =
+        analytics_type == ENCRYPTO::PsiAnalyticsContext::SUM
+            ? ENCRYPTO::PlainIntersectionSize(client_inputs, server_inputs)
+            : ENCRYPTO::PlainIntersectionPayloadSum(client_inputs, server_inputs, server_payloads);
+    ASSERT_EQ(psi_client, expected);
+    ASSERT_EQ(psi_server, expected);
+  }
+
+  // a table with fewer bins than elements has to stash some of them, which the client rejects
+  // before it connects if there are not enough stash bins
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  client_context.nbins = NELES_2_12 / 2;
+  client_context.nstashbins = 3;
+  ASSERT_THROW(ENCRYPTO::OpprgPsiClient(client_inputs, client_context), std::runtime_error);
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_planned_parameters) {
+  // the Chernoff bound of the planner is slightly more conservative than the tuned constants
+  const auto nbins_2_20 = static_cast<uint64_t>(NELES_2_20 * 1.27f);
+  const auto polynomialsize = ENCRYPTO::MinPolynomialSize(3 * NELES_2_20, nbins_2_20,
+                                                          NMEGABINS_2_20, 40);
+  ASSERT_GE(polynomialsize, POLYNOMIALSIZE_2_20);
+  ASSERT_LE(polynomialsize, POLYNOMIALSIZE_2_20 * 1.05);
+
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  // only the server plans, the client gets the parameters from it
+  auto server_parameters = ENCRYPTO::PlanParameters({NELES_2_12, NELES_2_12});
+  ENCRYPTO::PsiParameters client_parameters{};
+  std::thread client_exchange(
+      [&]() { ENCRYPTO::ExchangeParameters(client_parameters, client_context); });
+  ENCRYPTO::ExchangeParameters(server_parameters, server_context);
+  client_exchange.join();
+  ASSERT_EQ(client_parameters.nfuns, server_parameters.nfuns);
+  ASSERT_EQ(client_parameters.epsilon, server_parameters.epsilon);
+  ASSERT_EQ(client_parameters.nbins, server_parameters.nbins);
+  ASSERT_EQ(client_parameters.nmegabins, server_parameters.nmegabins);
+  ASSERT_EQ(client_parameters.polynomialsize, server_parameters.polynomialsize);
+  ENCRYPTO::ApplyParameters(client_parameters, client_context);
+  ENCRYPTO::ApplyParameters(server_parameters, server_context);
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+
+  std::uint64_t psi_client, psi_server;
+  std::thread client_thread(
+      [&]() { psi_client = run_psi_analytics(client_inputs, client_context); });
+  std::thread server_thread(
+      [&]() { psi_server = run_psi_analytics(server_inputs, server_context); });
+
+  client_thread.join();
+  server_thread.join();
+
+  auto plain_intersection_size = ENCRYPTO::PlainIntersectionSize(client_inputs, server_inputs);
+  ASSERT_EQ(psi_client, plain_intersection_size);
+  ASSERT_EQ(psi_server, plain_intersection_size);
+}
+
+TEST(PSI_ANALYTICS, radix_sort_unique) {
+  std::mt19937_64 engine(0);
+  for (auto bitlen : {15ull, 40ull, 64ull}) {
+    std::vector<std::uint64_t> elements(1 << 16);
+    for (auto &element : elements) {
+      element = engine() >> (64 - bitlen);
+    }
+    auto expected = elements;
+    std::sort(expected.begin(), expected.end());
+    expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+
+    std::vector<std::uint64_t> expected_hashes;
+    for (auto element : expected) {
+      expected_hashes.push_back(ENCRYPTO::HashingTable::ElementToHash(element) &
+                                ENCRYPTO::__61_bit_mask);
+    }
+
+    for (auto nthreads : {1ull, 3ull}) {
+      auto sorted = elements;
+      ENCRYPTO::SortUnique(sorted, nthreads);
+      ASSERT_EQ(sorted, expected);
+      ASSERT_EQ(ENCRYPTO::PreprocessElements(elements, nthreads), expected_hashes);
+    }
+  }
+
+  // the generated elements are distinct even if many duplicates are drawn
+  auto generated = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 13, 0, 2);
+  ASSERT_EQ(generated.size(), NELES_2_12);
+  std::sort(generated.begin(), generated.end());
+  ASSERT_EQ(std::adjacent_find(generated.begin(), generated.end()), generated.end());
+}
+
+TEST(PSI_ANALYTICS, records_from_file) {
+  std::vector<std::string> records;
+  for (auto i = 0ull; i < 1000; ++i) {
+    records.push_back("user" + std::to_string(i % 700) + "@example.com" + std::string(i % 37, 'x'));
+  }
+  std::string directory = testing::TempDir() + "records_testXXXXXX";
+  ASSERT_NE(mkdtemp(&directory[0]), nullptr);
+  const auto lines_path = directory + "/records.txt";
+  const auto length_prefixed_path = directory + "/records.bin";
+  {
+    std::ofstream lines(lines_path), length_prefixed(length_prefixed_path, std::ios::binary);
+    for (auto i = 0ull; i < records.size(); ++i) {
+      lines << records.at(i) << (i % 3 == 0 ? "\r\n" : "\n") << (i % 10 == 0 ? "\n" : "");
+      const auto size = static_cast<uint32_t>(records.at(i).size());
+      length_prefixed.write(reinterpret_cast<const char *>(&size), sizeof(size));
+      length_prefixed.write(records.at(i).data(), size);
+    }
+  }
+
+  std::vector<std::uint64_t> expected;
+  for (const auto &record : records) {
+    expected.push_back(
+        ENCRYPTO::HashRecord(reinterpret_cast<const uint8_t *>(record.data()), record.size()));
+  }
+  std::sort(expected.begin(), expected.end());
+  expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+  ASSERT_EQ(expected.size(), 1000u);
+
+  for (auto nthreads : {1ull, 3ull}) {
+    EXPECT_EQ(ENCRYPTO::ReadElementsFromFile(lines_path, ENCRYPTO::RecordFormat::LINES, nthreads),
+              expected);
+    EXPECT_EQ(ENCRYPTO::ReadElementsFromFile(length_prefixed_path,
+                                             ENCRYPTO::RecordFormat::LENGTH_PREFIXED, nthreads),
+              expected);
+  }
+  std::remove(lines_path.c_str());
+  std::remove(length_prefixed_path.c_str());
+  rmdir(directory.c_str());
+}
+
 TEST(PSI_ANALYTICS, pow_2_12_threshold) {
   for (auto i = 0ull; i < ITERATIONS; ++i) {
     // client's context
@@ -273,6 +919,299 @@ TEST(PSI_ANALYTICS, pow_2_12_sum_if_gt_threshold) {
   }
 }
 
+TEST(PSI_ANALYTICS, pow_2_12_multiple_thresholds) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+
+  auto plain_intersection_size = ENCRYPTO::PlainIntersectionSize(client_inputs, server_inputs);
+  assert(plain_intersection_size != 0);
+
+  for (auto analytics_type : {ENCRYPTO::PsiAnalyticsContext::THRESHOLD,
+                              ENCRYPTO::PsiAnalyticsContext::SUM_IF_GT_THRESHOLD}) {
+    for (auto context : {&client_context, &server_context}) {
+      context->analytics_type = analytics_type;
+      context->thresholds = {plain_intersection_size - 1, plain_intersection_size,
+                             plain_intersection_size + 1};
+      context->output_sum = true;
+    }
+
+    std::thread client_thread([&]() { run_psi_analytics(client_inputs, client_context); });
+    std::thread server_thread([&]() { run_psi_analytics(server_inputs, server_context); });
+
+    client_thread.join();
+    server_thread.join();
+
+    const std::uint64_t above =
+        analytics_type == ENCRYPTO::PsiAnalyticsContext::THRESHOLD ? 1 : plain_intersection_size;
+    const std::vector<std::uint64_t> expected = {above, 0, 0, plain_intersection_size};
+    ASSERT_EQ(client_context.outputs, expected);
+    ASSERT_EQ(server_context.outputs, expected);
+  }
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_circuit_types) {
+  for (auto circuit_type :
+       {ENCRYPTO::PsiAnalyticsContext::GMW, ENCRYPTO::PsiAnalyticsContext::YAO,
+        ENCRYPTO::PsiAnalyticsContext::YAO_ARITHMETIC}) {
+    auto cc = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+    auto sc = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+    cc.analytics_type = sc.analytics_type = ENCRYPTO::PsiAnalyticsContext::SUM_IF_GT_THRESHOLD;
+    cc.circuit_type = sc.circuit_type = circuit_type;
+    PsiAnalyticsSumIfGtThresholdTest(cc, sc);
+  }
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_native_backend) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+
+  auto plain_intersection_size = ENCRYPTO::PlainIntersectionSize(client_inputs, server_inputs);
+  assert(plain_intersection_size != 0);
+
+  for (auto analytics_type :
+       {ENCRYPTO::PsiAnalyticsContext::SUM, ENCRYPTO::PsiAnalyticsContext::THRESHOLD,
+        ENCRYPTO::PsiAnalyticsContext::SUM_IF_GT_THRESHOLD}) {
+    for (auto context : {&client_context, &server_context}) {
+      context->analytics_backend = ENCRYPTO::PsiAnalyticsContext::NATIVE;
+      context->analytics_type = analytics_type;
+      context->thresholds = {plain_intersection_size - 1, plain_intersection_size,
+                             plain_intersection_size + 1};
+      context->output_sum = true;
+    }
+
+    std::thread client_thread([&]() { run_psi_analytics(client_inputs, client_context); });
+    std::thread server_thread([&]() { run_psi_analytics(server_inputs, server_context); });
+
+    client_thread.join();
+    server_thread.join();
+
+    std::vector<std::uint64_t> expected = {plain_intersection_size};
+    if (analytics_type != ENCRYPTO::PsiAnalyticsContext::SUM) {
+      const std::uint64_t above =
+          analytics_type == ENCRYPTO::PsiAnalyticsContext::THRESHOLD ? 1 : plain_intersection_size;
+      expected = {above, 0, 0, plain_intersection_size};
+    }
+    ASSERT_EQ(client_context.outputs, expected);
+    ASSERT_EQ(server_context.outputs, expected);
+  }
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_native_backend_match_shares) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  for (auto context : {&client_context, &server_context}) {
+    context->analytics_backend = ENCRYPTO::PsiAnalyticsContext::NATIVE;
+    context->analytics_type = ENCRYPTO::PsiAnalyticsContext::MATCH_SHARES;
+  }
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+
+  ENCRYPTO::MatchShares client_shares, server_shares;
+  std::thread client_thread(
+      [&]() { client_shares = run_psi_match_shares(client_inputs, client_context); });
+  std::thread server_thread(
+      [&]() { server_shares = run_psi_match_shares(server_inputs, server_context); });
+
+  client_thread.join();
+  server_thread.join();
+
+  ASSERT_EQ(client_shares.nbins, server_shares.nbins);
+  ASSERT_EQ(client_shares.bits.size(), server_shares.bits.size());
+  const std::unordered_set<std::uint64_t> server_set(server_inputs.begin(), server_inputs.end());
+  std::size_t nmatches = 0;
+  for (auto bin = 0ull; bin < client_shares.nbins; ++bin) {
+    const bool match = client_shares.GetShare(bin) ^ server_shares.GetShare(bin);
+    const bool occupied = client_shares.offsets.at(bin + 1) > client_shares.offsets.at(bin);
+    const bool expected =
+        occupied && server_set.count(client_shares.elements.at(client_shares.offsets.at(bin))) > 0;
+    ASSERT_EQ(match, expected);
+    nmatches += match;
+  }
+  ASSERT_EQ(nmatches, ENCRYPTO::PlainIntersectionSize(client_inputs, server_inputs));
+  // the native backend reports its phases in the aby_* timings
+  ASSERT_GT(client_context.timings.aby_online, 0.0);
+  ASSERT_GT(server_context.timings.aby_online, 0.0);
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_payload_sum) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  client_context.analytics_type = ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM;
+  server_context.analytics_type = ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM;
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+  auto server_payloads = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 20, 2);
+
+  auto plain_payload_sum =
+      ENCRYPTO::PlainIntersectionPayloadSum(client_inputs, server_inputs, server_payloads);
+  ASSERT_NE(plain_payload_sum, 0u);
+
+  std::uint64_t psi_client, psi_server;
+  std::thread client_thread(
+      [&]() { psi_client = run_psi_analytics(client_inputs, {}, client_context); });
+  std::thread server_thread([&]() {
+    psi_server = run_psi_analytics(server_inputs, server_payloads, server_context);
+  });
+
+  client_thread.join();
+  server_thread.join();
+
+  ASSERT_EQ(psi_client, plain_payload_sum);
+  ASSERT_EQ(psi_server, plain_payload_sum);
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_payload_masks) {
+  constexpr std::size_t PAYLOAD_BITLEN = 8;
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  client_context.analytics_type = ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM;
+  server_context.analytics_type = ENCRYPTO::PsiAnalyticsContext::PAYLOAD_SUM;
+  server_context.payload_bitlen = PAYLOAD_BITLEN;
+  // the client keeps all 61 bits of what it gets out of the OPPRF
+  client_context.payload_bitlen = client_context.maxbitlen;
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+  auto server_payloads = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, PAYLOAD_BITLEN, 2);
+
+  std::vector<std::uint64_t> client_bins, server_bins, client_payload_bins, server_payload_bins;
+  std::thread client_thread([&]() {
+    client_bins = ENCRYPTO::OpprgPsiClient(client_inputs, client_context, &client_payload_bins);
+  });
+  std::thread server_thread([&]() {
+    server_bins = ENCRYPTO::OpprgPsiServer(server_inputs, server_context, server_payloads,
+                                           &server_payload_bins);
+  });
+
+  client_thread.join();
+  server_thread.join();
+
+  ASSERT_EQ(client_bins.size(), server_bins.size());
+  ASSERT_EQ(client_payload_bins.size(), client_bins.size());
+  ASSERT_EQ(server_payload_bins.size(), server_bins.size());
+
+  // the bits above the payload bit length look the same for matched and non-matched bins
+  std::size_t nmatched = 0, nmatched_high_bits = 0, nother_high_bits = 0;
+  for (auto i = 0ull; i < client_bins.size(); ++i) {
+    const auto high_bits = client_payload_bins.at(i) >> PAYLOAD_BITLEN;
+    ASSERT_NE(high_bits, 0u);
+    ASSERT_LT(server_payload_bins.at(i), 1ull << PAYLOAD_BITLEN);
+    if (client_bins.at(i) == server_bins.at(i)) {
+      ++nmatched;
+      nmatched_high_bits += __builtin_popcountll(high_bits);
+    } else {
+      nother_high_bits += __builtin_popcountll(high_bits);
+    }
+  }
+  const auto nother = client_bins.size() - nmatched;
+  ASSERT_GT(nmatched, 0u);
+  ASSERT_GT(nother, 0u);
+  // about half of the 53 high bits are set in either case
+  const double expected_high_bits = (client_context.maxbitlen - PAYLOAD_BITLEN) / 2.0;
+  ASSERT_NEAR(static_cast<double>(nmatched_high_bits) / nmatched, expected_high_bits, 1.0);
+  ASSERT_NEAR(static_cast<double>(nother_high_bits) / nother, expected_high_bits, 1.0);
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_grouped_sum) {
+  constexpr std::size_t NCATEGORIES = 5;
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  for (auto context : {&client_context, &server_context}) {
+    context->analytics_type = ENCRYPTO::PsiAnalyticsContext::GROUPED_SUM;
+    context->ncategories = NCATEGORIES;
+  }
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+  std::vector<std::uint64_t> server_categories(NELES_2_12);
+  for (auto i = 0ull; i < server_categories.size(); ++i) {
+    server_categories.at(i) = server_inputs.at(i) % NCATEGORIES;
+  }
+
+  const std::unordered_set<std::uint64_t> client_set(client_inputs.begin(), client_inputs.end());
+  std::vector<std::uint64_t> plain_counts(NCATEGORIES, 0);
+  for (auto i = 0ull; i < server_inputs.size(); ++i) {
+    if (client_set.count(server_inputs.at(i)) > 0) {
+      ++plain_counts.at(server_categories.at(i));
+    }
+  }
+
+  std::thread client_thread([&]() { run_psi_analytics(client_inputs, {}, client_context); });
+  std::thread server_thread(
+      [&]() { run_psi_analytics(server_inputs, server_categories, server_context); });
+
+  client_thread.join();
+  server_thread.join();
+
+  ASSERT_EQ(client_context.outputs, plain_counts);
+  ASSERT_EQ(server_context.outputs, plain_counts);
+
+  // too many categories are rejected by both parties before anything is sent
+  client_context.ncategories = server_context.ncategories = 64;
+  bool client_threw = false, server_threw = false;
+  client_thread = std::thread([&]() {
+    try {
+      run_psi_analytics(client_inputs, {}, client_context);
+    } catch (const std::runtime_error &) {
+      client_threw = true;
+    }
+  });
+  server_thread = std::thread([&]() {
+    try {
+      run_psi_analytics(server_inputs, server_categories, server_context);
+    } catch (const std::runtime_error &) {
+      server_threw = true;
+    }
+  });
+
+  client_thread.join();
+  server_thread.join();
+
+  ASSERT_TRUE(client_threw);
+  ASSERT_TRUE(server_threw);
+}
+
+TEST(PSI_ANALYTICS, pow_2_12_match_shares) {
+  auto client_context = CreateContext(CLIENT, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  auto server_context = CreateContext(SERVER, NELES_2_12, POLYNOMIALSIZE_2_12, NMEGABINS_2_12);
+  client_context.analytics_type = ENCRYPTO::PsiAnalyticsContext::MATCH_SHARES;
+  server_context.analytics_type = ENCRYPTO::PsiAnalyticsContext::MATCH_SHARES;
+
+  auto client_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 0);
+  auto server_inputs = ENCRYPTO::GeneratePseudoRandomElements(NELES_2_12, 15, 1);
+
+  ENCRYPTO::MatchShares client_shares, server_shares;
+  std::thread client_thread(
+      [&]() { client_shares = run_psi_match_shares(client_inputs, client_context); });
+  std::thread server_thread(
+      [&]() { server_shares = run_psi_match_shares(server_inputs, server_context); });
+
+  client_thread.join();
+  server_thread.join();
+
+  // the shares survive the binary format
+  server_shares = ENCRYPTO::DeserializeMatchShares(ENCRYPTO::SerializeMatchShares(server_shares));
+
+  ASSERT_EQ(client_shares.nbins, server_shares.nbins);
+  const std::unordered_set<std::uint64_t> server_set(server_inputs.begin(), server_inputs.end());
+  std::size_t nmatches = 0;
+  for (auto bin = 0ull; bin < client_shares.nbins; ++bin) {
+    const bool match = client_shares.GetShare(bin) ^ server_shares.GetShare(bin);
+    const bool occupied = client_shares.offsets.at(bin + 1) > client_shares.offsets.at(bin);
+    const bool expected =
+        occupied && server_set.count(client_shares.elements.at(client_shares.offsets.at(bin))) > 0;
+    ASSERT_EQ(match, expected);
+    nmatches += match;
+  }
+  ASSERT_EQ(nmatches, ENCRYPTO::PlainIntersectionSize(client_inputs, server_inputs));
+}
+
 TEST(PSI_ANALYTICS, pow_2_12_sum) {
   for (auto i = 0ull; i < ITERATIONS; ++i) {
     // client's context